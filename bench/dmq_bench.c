@@ -0,0 +1,80 @@
+/*
+ dmq_bench - round-trip benchmark for the dmarquees control socket
+
+ Usage: dmq_bench [-n COUNT] [COMMAND]...
+   Sends COUNT commands (default 200) over one persistent libdmarquees connection, cycling
+   through the given commands (default: CLEAR), and reports the round-trip latency p50/p99/max
+   and the throughput. Use ROM names to measure decode+blit, RESET for the bare IPC path.
+*/
+
+#include "dmq_client.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// nearest-rank percentile of a sorted sample
+static uint64_t percentile(const uint64_t *v, int n, int p)
+{
+    int rank = (p * n + 99) / 100;
+    return v[rank > 0 ? rank - 1 : 0];
+}
+
+int main(int argc, char **argv)
+{
+    int count = 200;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:h")) != -1)
+    {
+        if (opt == 'n' && atoi(optarg) > 0)
+            count = atoi(optarg);
+        else
+        {
+            fprintf(stderr, "Usage: %s [-n COUNT] [COMMAND]...\n", argv[0]);
+            return 2;
+        }
+    }
+    char *default_cmd[] = {"CLEAR"};
+    char **cmds = optind < argc ? &argv[optind] : default_cmd;
+    int ncmds = optind < argc ? argc - optind : 1;
+
+    uint64_t *rtt = calloc((size_t)count, sizeof(uint64_t));
+    if (!rtt || dmq_open() != 0)
+    {
+        fprintf(stderr, "dmq_bench: cannot connect to dmarquees\n");
+        return 1;
+    }
+
+    int errors = 0;
+    uint64_t start = now_us();
+    for (int i = 0; i < count; ++i)
+    {
+        uint64_t t0 = now_us();
+        if (dmq_command(cmds[i % ncmds], NULL, 0) == DMQ_ERROR)
+            errors++;
+        rtt[i] = now_us() - t0;
+    }
+    uint64_t elapsed = now_us() - start;
+    dmq_close();
+
+    qsort(rtt, (size_t)count, sizeof(uint64_t), cmp_u64);
+    printf("commands=%d errors=%d p50_us=%llu p99_us=%llu max_us=%llu throughput=%.1f/s\n", count, errors,
+           (unsigned long long)percentile(rtt, count, 50), (unsigned long long)percentile(rtt, count, 99),
+           (unsigned long long)rtt[count - 1], elapsed ? count * 1e6 / elapsed : 0.0);
+    free(rtt);
+    return errors ? 1 : 0;
+}
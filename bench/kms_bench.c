@@ -0,0 +1,498 @@
+/*
+ dmq_kmsbench - KMS ioctl latencies and scanout checks on a DRM card (meant for vkms)
+
+ Usage: dmq_kmsbench [-n REPS] CARD           e.g. dmq_kmsbench /dev/dri/card0
+        dmq_kmsbench [-n REPS] -H CARD        master handover with a running "dmarquees -c CARD"
+   The first form drives the first connected connector directly, as dmarquees does: creating a
+   dumb framebuffer (CREATE_DUMB + MAP_DUMB + mmap + ADDFB2) and destroying it,
+   drmModeSetCrtc, page flips (ioctl and flip-to-event latency), a vblank wait and
+   drmSetMaster/drmDropMaster. If the kernel exposes CRTC CRCs in debugfs
+   (/sys/kernel/debug/dri/N/crtc-M/crc, vkms does), it also checks that what is scanned out
+   follows the framebuffer: two colors must give two CRCs and the first color its first CRC again.
+   The -H form plays MAME: it takes master and the CRTC, checks that RESET is answered
+   crtc=pending, drops master and times the daemon's reacquisition with RESET (crtc=ok).
+   Results are JSON in the format of dmq_microbench (median/MAD/min/max in ns); exits 1 if a
+   check fails. bench/vkms_bench.sh runs both around the daemon ("make vkms-bench").
+*/
+
+#define _GNU_SOURCE
+#include "dmq_client.h"
+#include <drm/drm.h>
+#include <drm/drm_fourcc.h>
+#include <drm/drm_mode.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <time.h>
+#include <unistd.h>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#define CRC_SETTLE_FRAMES 3     // CRC lines read after a change; the last one is used
+
+typedef struct
+{
+    uint32_t handle;
+    uint32_t fb_id;
+    uint32_t stride;
+    uint64_t size;
+    uint32_t *map;
+} DumbFb;
+
+static int fd = -1;
+static uint32_t conn_id, crtc_id;
+static int pipe_index;
+static drmModeModeInfo mode;
+static int reps = 50;
+static bool first_result = true;
+static int failures = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t median(uint64_t *v, int n)
+{
+    qsort(v, (size_t)n, sizeof(uint64_t), cmp_u64);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// One JSON result from n samples (ns); sorts t
+static void report(const char *name, const char *params, uint64_t *t, int n)
+{
+    if (n <= 0)
+        return;
+    uint64_t *dev = calloc((size_t)n, sizeof(uint64_t));
+    if (!dev)
+        return;
+    uint64_t med = median(t, n);
+    for (int i = 0; i < n; ++i)
+        dev[i] = t[i] > med ? t[i] - med : med - t[i];
+    printf("%s    {\"name\": \"%s\", \"params\": \"%s\", \"unit\": \"ns\", \"reps\": %d, "
+           "\"median\": %llu, \"mad\": %llu, \"min\": %llu, \"max\": %llu}",
+           first_result ? "" : ",\n", name, params, n, (unsigned long long)med,
+           (unsigned long long)median(dev, n), (unsigned long long)t[0], (unsigned long long)t[n - 1]);
+    first_result = false;
+    free(dev);
+}
+
+static void check(bool ok, const char *what)
+{
+    fprintf(stderr, "dmq_kmsbench: %s: %s\n", what, ok ? "ok" : "FAILED");
+    if (!ok)
+        failures++;
+}
+
+// First connected connector with a mode, and a CRTC its first encoder can drive
+static int find_output(void)
+{
+    drmModeRes *res = drmModeGetResources(fd);
+    if (!res)
+        return -1;
+    for (int i = 0; i < res->count_connectors && !conn_id; ++i)
+    {
+        drmModeConnector *conn = drmModeGetConnector(fd, res->connectors[i]);
+        if (!conn)
+            continue;
+        drmModeEncoder *enc = conn->count_encoders ? drmModeGetEncoder(fd, conn->encoders[0]) : NULL;
+        if (conn->connection == DRM_MODE_CONNECTED && conn->count_modes > 0 && enc)
+        {
+            for (int c = 0; c < res->count_crtcs; ++c)
+            {
+                if (enc->possible_crtcs & (1u << c))
+                {
+                    conn_id = conn->connector_id;
+                    crtc_id = res->crtcs[c];
+                    pipe_index = c;
+                    mode = conn->modes[0];
+                    break;
+                }
+            }
+        }
+        drmModeFreeEncoder(enc);
+        drmModeFreeConnector(conn);
+    }
+    drmModeFreeResources(res);
+    return conn_id ? 0 : -1;
+}
+
+static int create_fb(DumbFb *fb)
+{
+    struct drm_mode_create_dumb creq = {.width = mode.hdisplay, .height = mode.vdisplay, .bpp = 32};
+    memset(fb, 0, sizeof(*fb));
+    if (ioctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0)
+        return -1;
+    fb->handle = creq.handle;
+    fb->stride = creq.pitch;
+    fb->size = creq.size;
+
+    struct drm_mode_map_dumb mreq = {.handle = fb->handle};
+    uint32_t handles[4] = {fb->handle}, pitches[4] = {fb->stride}, offsets[4] = {0};
+    if (ioctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) < 0 ||
+        (fb->map = mmap(NULL, fb->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset)) == MAP_FAILED ||
+        drmModeAddFB2(fd, mode.hdisplay, mode.vdisplay, DRM_FORMAT_XRGB8888, handles, pitches, offsets, &fb->fb_id,
+                      0) != 0)
+    {
+        if (fb->map == MAP_FAILED)
+            fb->map = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void destroy_fb(DumbFb *fb)
+{
+    if (fb->fb_id)
+        drmModeRmFB(fd, fb->fb_id);
+    if (fb->map)
+        munmap(fb->map, fb->size);
+    if (fb->handle)
+    {
+        struct drm_mode_destroy_dumb dreq = {.handle = fb->handle};
+        ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+    }
+    memset(fb, 0, sizeof(*fb));
+}
+
+static void fill(DumbFb *fb, uint32_t xrgb)
+{
+    for (uint32_t y = 0; y < mode.vdisplay; ++y)
+    {
+        uint32_t *row = (uint32_t *)((uint8_t *)fb->map + (size_t)y * fb->stride);
+        for (uint32_t x = 0; x < mode.hdisplay; ++x)
+            row[x] = xrgb;
+    }
+}
+
+static bool flip_done;
+
+static void flip_handler(int f, unsigned int seq, unsigned int sec, unsigned int usec, void *data)
+{
+    (void)f;
+    (void)seq;
+    (void)sec;
+    (void)usec;
+    (void)data;
+    flip_done = true;
+}
+
+// Wait (up to 1 s) for the event of the pending drmModePageFlip; 0 or -1
+static int wait_flip(void)
+{
+    drmEventContext ctx = {.version = 2, .page_flip_handler = flip_handler};
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    while (!flip_done)
+    {
+        if (poll(&pfd, 1, 1000) <= 0 || drmHandleEvent(fd, &ctx) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+static void bench_ioctls(void)
+{
+    uint64_t *create = calloc((size_t)reps, sizeof(uint64_t));
+    uint64_t *destroy = calloc((size_t)reps, sizeof(uint64_t));
+    uint64_t *setcrtc = calloc((size_t)reps, sizeof(uint64_t));
+    uint64_t *flip_ioctl = calloc((size_t)reps, sizeof(uint64_t));
+    uint64_t *flip_event = calloc((size_t)reps, sizeof(uint64_t));
+    uint64_t *vblank = calloc((size_t)reps, sizeof(uint64_t));
+    uint64_t *set_master = calloc((size_t)reps, sizeof(uint64_t));
+    uint64_t *drop_master = calloc((size_t)reps, sizeof(uint64_t));
+    if (!create || !destroy || !setcrtc || !flip_ioctl || !flip_event || !vblank || !set_master || !drop_master)
+    {
+        fprintf(stderr, "dmq_kmsbench: out of memory\n");
+        exit(1);
+    }
+    char params[64];
+    snprintf(params, sizeof(params), "%ux%u@%u XR24", mode.hdisplay, mode.vdisplay, mode.vrefresh);
+
+    int n_create = 0, n_setcrtc = 0, n_flip = 0, n_vblank = 0, n_master = 0;
+    for (int i = 0; i < reps; ++i)
+    {
+        DumbFb fb;
+        uint64_t t0 = now_ns();
+        if (create_fb(&fb) == 0)
+        {
+            create[n_create] = now_ns() - t0;
+            t0 = now_ns();
+            destroy_fb(&fb);
+            destroy[n_create++] = now_ns() - t0;
+        }
+        else
+            destroy_fb(&fb);
+    }
+    report("create_dumb_fb", params, create, n_create);
+    report("destroy_dumb_fb", params, destroy, n_create);
+    check(n_create == reps, "dumb framebuffers");
+
+    DumbFb fbs[2] = {{0}};
+    if (create_fb(&fbs[0]) != 0 || create_fb(&fbs[1]) != 0)
+    {
+        check(false, "framebuffers for scanout");
+        goto out;
+    }
+    fill(&fbs[0], 0x00ff0000);
+    fill(&fbs[1], 0x000000ff);
+    for (int i = 0; i < reps; ++i)
+    {
+        uint64_t t0 = now_ns();
+        if (drmModeSetCrtc(fd, crtc_id, fbs[i & 1].fb_id, 0, 0, &conn_id, 1, &mode) == 0)
+            setcrtc[n_setcrtc++] = now_ns() - t0;
+    }
+    report("set_crtc", params, setcrtc, n_setcrtc);
+    check(n_setcrtc == reps, "drmModeSetCrtc");
+
+    for (int i = 0; i < reps; ++i)
+    {
+        flip_done = false;
+        uint64_t t0 = now_ns();
+        if (drmModePageFlip(fd, crtc_id, fbs[(i + 1) & 1].fb_id, DRM_MODE_PAGE_FLIP_EVENT, NULL) != 0)
+            continue;
+        uint64_t t1 = now_ns();
+        if (wait_flip() == 0)
+        {
+            flip_ioctl[n_flip] = t1 - t0;
+            flip_event[n_flip++] = now_ns() - t0;
+        }
+    }
+    report("page_flip_ioctl", params, flip_ioctl, n_flip);
+    report("page_flip_to_event", params, flip_event, n_flip);
+    check(n_flip == reps, "page flips");
+
+    for (int i = 0; i < reps; ++i)
+    {
+        drmVBlank vbl;
+        memset(&vbl, 0, sizeof(vbl));
+        vbl.request.type = (drmVBlankSeqType)(DRM_VBLANK_RELATIVE |
+                                              ((pipe_index << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK));
+        vbl.request.sequence = 1;
+        uint64_t t0 = now_ns();
+        if (drmWaitVBlank(fd, &vbl) == 0)
+            vblank[n_vblank++] = now_ns() - t0;
+    }
+    report("wait_vblank", params, vblank, n_vblank);
+    check(n_vblank == reps, "vblank waits");
+
+    for (int i = 0; i < reps; ++i)
+    {
+        uint64_t t0 = now_ns();
+        if (drmDropMaster(fd) != 0)
+            continue;
+        uint64_t t1 = now_ns();
+        if (drmSetMaster(fd) != 0)
+            continue;
+        drop_master[n_master] = t1 - t0;
+        set_master[n_master++] = now_ns() - t1;
+    }
+    report("drop_master", params, drop_master, n_master);
+    report("set_master", params, set_master, n_master);
+    check(n_master == reps, "master set/drop");
+
+out:
+    destroy_fb(&fbs[0]);
+    destroy_fb(&fbs[1]);
+    free(create);
+    free(destroy);
+    free(setcrtc);
+    free(flip_ioctl);
+    free(flip_event);
+    free(vblank);
+    free(set_master);
+    free(drop_master);
+}
+
+// debugfs CRC directory of our CRTC, from the card's minor number
+static bool crc_dir(char *buf, size_t size)
+{
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+        return false;
+    snprintf(buf, size, "/sys/kernel/debug/dri/%u/crtc-%d/crc", minor(st.st_rdev), pipe_index);
+    return access(buf, F_OK) == 0;
+}
+
+// CRC of the frame after CRC_SETTLE_FRAMES frames; data lines are "<frame> <crc>..."
+static bool read_crc(FILE *data, char *crc, size_t size)
+{
+    char line[128];
+    for (int i = 0; i < CRC_SETTLE_FRAMES; ++i)
+    {
+        if (!fgets(line, sizeof(line), data))
+            return false;
+    }
+    char *sp = strchr(line, ' ');
+    if (!sp)
+        return false;
+    snprintf(crc, size, "%s", sp + 1);
+    crc[strcspn(crc, "\n")] = '\0';
+    return true;
+}
+
+/* Scanout follows the framebuffer: color A, color B, then A again must read back as two
+   different CRCs, the third equal to the first */
+static void check_crc(void)
+{
+    char dir[128], path[160];
+    if (!crc_dir(dir, sizeof(dir)))
+    {
+        fprintf(stderr, "dmq_kmsbench: no CRTC CRCs in debugfs (mounted? root?), scanout not checked\n");
+        return;
+    }
+    snprintf(path, sizeof(path), "%s/control", dir);
+    FILE *control = fopen(path, "w");
+    if (!control || fputs("auto", control) < 0 || fclose(control) != 0)
+    {
+        check(false, "CRC source");
+        return;
+    }
+
+    DumbFb fbs[2] = {{0}};
+    if (create_fb(&fbs[0]) != 0 || create_fb(&fbs[1]) != 0)
+    {
+        check(false, "framebuffers for the CRC check");
+        destroy_fb(&fbs[0]);
+        destroy_fb(&fbs[1]);
+        return;
+    }
+    fill(&fbs[0], 0x00ff8000);
+    fill(&fbs[1], 0x000080ff);
+    drmModeSetCrtc(fd, crtc_id, fbs[0].fb_id, 0, 0, &conn_id, 1, &mode);
+
+    snprintf(path, sizeof(path), "%s/data", dir);
+    FILE *data = fopen(path, "r");
+    char crc[3][64];
+    bool ok = data != NULL;
+    for (int i = 0; i < 3 && ok; ++i)
+    {
+        ok = drmModeSetCrtc(fd, crtc_id, fbs[i & 1].fb_id, 0, 0, &conn_id, 1, &mode) == 0 &&
+             read_crc(data, crc[i], sizeof(crc[i]));
+    }
+    if (data)
+        fclose(data);
+    check(ok && strcmp(crc[0], crc[1]) != 0 && strcmp(crc[0], crc[2]) == 0, "scanout CRC follows the framebuffer");
+    destroy_fb(&fbs[0]);
+    destroy_fb(&fbs[1]);
+}
+
+/* The emulator takes the display: the daemon cannot reset the CRTC until master is dropped */
+static void bench_handover(void)
+{
+    uint64_t *reacquire = calloc((size_t)reps, sizeof(uint64_t));
+    char reply[DMQ_REPLY_MAX];
+    DumbFb fb;
+    if (!reacquire || dmq_open() != 0 || create_fb(&fb) != 0)
+    {
+        check(false, "daemon connection and framebuffer (is dmarquees -c running?)");
+        free(reacquire);
+        return;
+    }
+    fill(&fb, 0x0000ff00);
+
+    int n = 0;
+    bool pending_ok = true, reacquire_ok = true;
+    for (int i = 0; i < reps; ++i)
+    {
+        if (drmSetMaster(fd) != 0 || drmModeSetCrtc(fd, crtc_id, fb.fb_id, 0, 0, &conn_id, 1, &mode) != 0)
+        {
+            pending_ok = false;
+            break;
+        }
+        dmq_command("RESET", reply, sizeof(reply));
+        pending_ok &= strstr(reply, "crtc=pending") != NULL;
+        drmDropMaster(fd);
+
+        uint64_t t0 = now_ns();
+        dmq_command("RESET", reply, sizeof(reply));
+        if (strstr(reply, "crtc=ok"))
+            reacquire[n++] = now_ns() - t0;
+        else
+            reacquire_ok = false;
+    }
+    char params[64];
+    snprintf(params, sizeof(params), "%ux%u@%u RESET after drmDropMaster", mode.hdisplay, mode.vdisplay,
+             mode.vrefresh);
+    report("daemon_reacquire", params, reacquire, n);
+    check(pending_ok, "RESET while another master holds the display is crtc=pending");
+    check(reacquire_ok, "RESET after the master is dropped is crtc=ok");
+
+    drmModeCrtc *crtc = drmModeGetCrtc(fd, crtc_id);
+    check(crtc && crtc->buffer_id && crtc->buffer_id != fb.fb_id, "daemon framebuffer scanned out again");
+    drmModeFreeCrtc(crtc);
+    destroy_fb(&fb);
+    dmq_close();
+    free(reacquire);
+}
+
+int main(int argc, char **argv)
+{
+    bool handover = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:Hh")) != -1)
+    {
+        if (opt == 'n' && atoi(optarg) > 0)
+            reps = atoi(optarg);
+        else if (opt == 'H')
+            handover = true;
+        else
+        {
+            fprintf(stderr, "Usage: %s [-n REPS] [-H] CARD\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "Usage: %s [-n REPS] [-H] CARD\n", argv[0]);
+        return 2;
+    }
+
+    fd = open(argv[optind], O_RDWR | O_CLOEXEC);
+    if (fd < 0)
+    {
+        perror(argv[optind]);
+        return 1;
+    }
+    if (find_output() != 0)
+    {
+        fprintf(stderr, "dmq_kmsbench: no connected output on %s\n", argv[optind]);
+        return 1;
+    }
+    // the first opener of a card becomes master implicitly; start from the daemon's state
+    drmDropMaster(fd);
+
+    printf("{\n  \"reps\": %d,\n  \"results\": [\n", reps);
+    if (handover)
+        bench_handover();
+    else
+    {
+        if (drmSetMaster(fd) != 0)
+        {
+            fprintf(stderr, "dmq_kmsbench: drmSetMaster: %s (root, and no other master?)\n", strerror(errno));
+            return 1;
+        }
+        bench_ioctls();
+        check_crc();
+        drmDropMaster(fd);
+    }
+    printf("\n  ]\n}\n");
+    close(fd);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,301 @@
+/*
+ dmq_microbench - microbenchmarks of the daemon's core paths, reported as JSON
+
+ Usage: dmq_microbench [-r REPS] [-w WARMUP] [PNG]...
+   Times load_png_rgba() on synthetic PNGs (written to a temp dir) and on the given real PNGs
+   (make bench passes the PNGs in images/), scale_and_blit_to_xrgb() at common scale ratios into a
+   heap buffer laid out like a dumb framebuffer mapping, and trim() / toCommandType() on
+   typical command lines. Each benchmark runs WARMUP untimed iterations (default 3), then REPS
+   timed ones (default 15), and reports the median and the median absolute deviation in ns.
+   make bench writes the report to bench.json (BENCH_OUT) for comparing two builds.
+*/
+
+#include "helpers.h"
+#include <png.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CMD_BATCH 10000 // trim/toCommandType calls per timed iteration (too fast to time singly)
+
+static int reps = 15;
+static int warmup = 3;
+static bool first_result = true;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint64_t median(uint64_t *v, int n)
+{
+    qsort(v, (size_t)n, sizeof(uint64_t), cmp_u64);
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2;
+}
+
+// JSON string body (quotes, backslashes and control characters escaped): params holds PNG paths
+static void put_json_string(const char *s)
+{
+    for (; *s; ++s)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            printf("\\%c", c);
+        else if (c < 0x20)
+            printf("\\u%04x", c);
+        else
+            putchar(c);
+    }
+}
+
+// Time fn(arg) reps times after warmup runs; per_call divides each sample (batched benchmarks)
+static void run_bench(const char *name, const char *params, void (*fn)(void *), void *arg, int per_call)
+{
+    uint64_t *t = calloc((size_t)reps, sizeof(uint64_t));
+    uint64_t *dev = calloc((size_t)reps, sizeof(uint64_t));
+    if (!t || !dev)
+    {
+        fprintf(stderr, "dmq_microbench: out of memory\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < warmup; ++i)
+        fn(arg);
+    for (int i = 0; i < reps; ++i)
+    {
+        uint64_t t0 = now_ns();
+        fn(arg);
+        t[i] = (now_ns() - t0) / (uint64_t)per_call;
+    }
+
+    uint64_t min = t[0], max = t[0];
+    for (int i = 1; i < reps; ++i)
+    {
+        min = t[i] < min ? t[i] : min;
+        max = t[i] > max ? t[i] : max;
+    }
+    uint64_t med = median(t, reps);
+    for (int i = 0; i < reps; ++i)
+        dev[i] = t[i] > med ? t[i] - med : med - t[i];
+    uint64_t mad = median(dev, reps);
+
+    printf("%s    {\"name\": \"", first_result ? "" : ",\n");
+    put_json_string(name);
+    printf("\", \"params\": \"");
+    put_json_string(params);
+    printf("\", \"unit\": \"ns\", \"reps\": %d, \"median\": %llu, \"mad\": %llu, \"min\": %llu, \"max\": %llu}", reps,
+           (unsigned long long)med, (unsigned long long)mad, (unsigned long long)min, (unsigned long long)max);
+    first_result = false;
+    free(t);
+    free(dev);
+}
+
+/* load_png_rgba */
+
+// Marquee-like synthetic image: gradients with some noise so it compresses like artwork
+static bool write_synthetic_png(const char *path, int w, int h)
+{
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+        return false;
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    uint8_t *row = malloc((size_t)w * 4);
+    if (!png || !info || !row)
+        goto fail;
+    if (setjmp(png_jmpbuf(png)))
+        goto fail;
+    png_init_io(png, fp);
+    png_set_IHDR(png, info, w, h, 8, PNG_COLOR_TYPE_RGBA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT,
+                 PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    uint32_t seed = 12345;
+    for (int y = 0; y < h; ++y)
+    {
+        for (int x = 0; x < w; ++x)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            row[x * 4 + 0] = (uint8_t)(x * 255 / w);
+            row[x * 4 + 1] = (uint8_t)(y * 255 / h);
+            row[x * 4 + 2] = (uint8_t)((x ^ y) + (seed >> 29));
+            row[x * 4 + 3] = 255;
+        }
+        png_write_row(png, row);
+    }
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    free(row);
+    fclose(fp);
+    return true;
+
+fail:
+    png_destroy_write_struct(&png, &info);
+    free(row);
+    fclose(fp);
+    return false;
+}
+
+static void bench_decode(void *arg)
+{
+    int w, h;
+    free(load_png_rgba(arg, &w, &h, NULL));
+}
+
+static void bench_png(const char *path, const char *label)
+{
+    int w, h;
+    uint8_t *img = load_png_rgba(path, &w, &h, NULL);
+    if (!img)
+    {
+        fprintf(stderr, "dmq_microbench: cannot decode %s, skipped\n", path);
+        return;
+    }
+    free(img);
+    char params[512];
+    snprintf(params, sizeof(params), "%s %dx%d", label, w, h);
+    run_bench("load_png_rgba", params, bench_decode, (void *)path, 1);
+}
+
+/* scale_and_blit_to_xrgb */
+
+typedef struct
+{
+    const uint8_t *src;
+    int src_w, src_h;
+    uint8_t *fb;    // stands in for Output.fb_map
+    int fb_w, fb_h, stride; // stride in pixels
+    PixelFormat fmt;
+    bool dither;
+} BlitArgs;
+
+static void bench_blit(void *arg)
+{
+    BlitArgs *a = arg;
+    scale_and_blit_to_xrgb(a->src, a->src_w, a->src_h, a->fb, a->fb_w, a->fb_h, a->stride, 0, a->fmt, a->dither,
+                           NULL);
+}
+
+static void bench_scale(const uint8_t *src, int src_w, int src_h, int fb_w, int fb_h, PixelFormat fmt, bool dither)
+{
+    // dumb buffers are allocated with a 64-byte aligned pitch; the blitter takes it in pixels
+    int cpp = pixel_format_bpp(fmt) / 8;
+    int pitch = (fb_w * cpp + 63) & ~63;
+    BlitArgs a = {src, src_w, src_h, aligned_alloc(64, (size_t)pitch * fb_h), fb_w, fb_h, pitch / cpp, fmt, dither};
+    if (!a.fb)
+        return;
+    memset(a.fb, 0, (size_t)pitch * fb_h);
+    static const char *fmt_names[] = {"XRGB8888", "XBGR8888", "ABGR8888", "RGB565"};
+    char params[128];
+    snprintf(params, sizeof(params), "%dx%d -> %dx%d %s%s x%.2f", src_w, src_h, fb_w, fb_h, fmt_names[fmt],
+             dither ? "+dither" : "", (double)fb_w / src_w);
+    run_bench("scale_and_blit_to_xrgb", params, bench_blit, &a, 1);
+    free(a.fb);
+}
+
+/* trim / toCommandType */
+
+static const char *const command_lines[] = {
+    "sf\n", "  1:mslug  \n", "CLEAR\n", "RESET\n", "PREFETCH galaga\n", "STATS\n", "  \t\n", "RA\n",
+};
+#define NUM_COMMAND_LINES (int)(sizeof(command_lines) / sizeof(command_lines[0]))
+
+static void bench_trim(void *arg)
+{
+    char buf[64];
+    volatile size_t sink = 0;
+    for (int i = 0; i < CMD_BATCH; ++i)
+    {
+        const char *line = command_lines[i % NUM_COMMAND_LINES];
+        size_t n = strlen(line) + 1;
+        memcpy(buf, line, n);
+        char *t = trim(buf, n);
+        sink += t ? (size_t)t[0] : 0;
+    }
+    (void)sink;
+}
+
+static void bench_command_type(void *arg)
+{
+    static const char *const trimmed[] = {"sf", "mslug", "CLEAR", "RESET", "PREFETCH galaga", "STATS", "EXIT", "RA"};
+    volatile int sink = 0;
+    for (int i = 0; i < CMD_BATCH; ++i)
+        sink += toCommandType(trimmed[i % 8]);
+    (void)sink;
+}
+
+int main(int argc, char **argv)
+{
+    int opt;
+    while ((opt = getopt(argc, argv, "r:w:h")) != -1)
+    {
+        if (opt == 'r' && atoi(optarg) > 0)
+            reps = atoi(optarg);
+        else if (opt == 'w' && atoi(optarg) >= 0)
+            warmup = atoi(optarg);
+        else
+        {
+            fprintf(stderr, "Usage: %s [-r REPS] [-w WARMUP] [PNG]...\n", argv[0]);
+            return 2;
+        }
+    }
+
+    g_mem_budget = 0; // no cap: the bench decodes whatever it is given
+
+    char dir[] = "/tmp/dmq_microbench.XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    printf("{\n  \"reps\": %d,\n  \"warmup\": %d,\n  \"results\": [\n", reps, warmup);
+
+    // synthetic corpus: small, typical marquee, full HD and an oversized source
+    static const int sizes[][2] = {{320, 80}, {1280, 320}, {1920, 1080}, {4096, 1024}};
+    for (int i = 0; i < 4; ++i)
+    {
+        char path[64];
+        snprintf(path, sizeof(path), "%s/synthetic_%dx%d.png", dir, sizes[i][0], sizes[i][1]);
+        if (write_synthetic_png(path, sizes[i][0], sizes[i][1]))
+        {
+            bench_png(path, "synthetic");
+            unlink(path);
+        }
+    }
+    rmdir(dir);
+    for (int i = optind; i < argc; ++i)
+        bench_png(argv[i], argv[i]);
+
+    // a 1280x320 marquee onto common panel widths (0.5x up to 3x), both depths
+    int src_w = 1280, src_h = 320;
+    uint8_t *src = malloc((size_t)src_w * src_h * 4);
+    if (src)
+    {
+        for (size_t i = 0; i < (size_t)src_w * src_h * 4; ++i)
+            src[i] = (uint8_t)(i * 2654435761u >> 24);
+        static const int panels[][2] = {{640, 160}, {1280, 390}, {1920, 480}, {2560, 720}, {3840, 1080}};
+        for (int i = 0; i < 5; ++i)
+            bench_scale(src, src_w, src_h, panels[i][0], panels[i][1], PIX_XRGB8888, false);
+        bench_scale(src, src_w, src_h, 1920, 480, PIX_XBGR8888, false);
+        bench_scale(src, src_w, src_h, 1920, 480, PIX_RGB565, false);
+        bench_scale(src, src_w, src_h, 1920, 480, PIX_RGB565, true);
+        free(src);
+    }
+
+    run_bench("trim", "per call, mixed command lines", bench_trim, NULL, CMD_BATCH);
+    run_bench("toCommandType", "per call, mixed commands", bench_command_type, NULL, CMD_BATCH);
+
+    printf("\n  ]\n}\n");
+    return 0;
+}
@@ -0,0 +1,75 @@
+#!/bin/sh
+# Run the real DRM path on the kernel's virtual KMS driver (vkms), without cabinet hardware.
+#
+#   1. dmq_kmsbench CARD: dumb FB create/destroy, SetCrtc, page flip, vblank and master ioctl
+#      latencies, and the scanout CRC check (debugfs)
+#   2. dmarquees -c CARD: connector/mode probing, framebuffer creation and CRTC resets of the
+#      daemon itself, timed with dmq_bench (CLEAR, marquees, RESET), then STATS and MEM
+#   3. dmq_kmsbench -H CARD: master handover with the running daemon
+#
+# Needs root (modprobe, DRM master, debugfs). Results go to $OUT (default vkms-bench/):
+# kms.json, handover.json, rtt.txt, stats.txt, daemon.log and the -P timeline.json.
+# Exits non-zero when vkms is unavailable or a check fails.
+
+OUT=${OUT:-vkms-bench}
+IMAGES=${IMAGES:-images}
+REPS=${REPS:-50}
+
+if [ "$(id -u)" != 0 ]; then
+    echo "vkms_bench: run as root (modprobe vkms, DRM master, debugfs CRCs)" >&2
+    exit 1
+fi
+modprobe vkms 2>/dev/null
+mount | grep -q " /sys/kernel/debug " || mount -t debugfs none /sys/kernel/debug 2>/dev/null
+
+card=
+for d in /sys/class/drm/card[0-9]*; do
+    case "$(readlink -f "$d/device")" in
+    */vkms*) card=/dev/dri/${d##*/}; break ;;
+    esac
+done
+if [ -z "$card" ]; then
+    echo "vkms_bench: no vkms card (kernel built without CONFIG_DRM_VKMS?)" >&2
+    exit 1
+fi
+echo "vkms_bench: using $card"
+mkdir -p "$OUT"
+status=0
+
+./dmq_kmsbench -n "$REPS" "$card" > "$OUT/kms.json" || status=1
+
+# a socket left by an earlier run would pass the wait below before this daemon listens
+rm -f /tmp/dmarquees.sock
+./dmarquees -c "$card" -o "Virtual-1=$IMAGES" -P "$OUT/timeline.json" > "$OUT/daemon.log" 2>&1 &
+pid=$!
+for i in 1 2 3 4 5 6 7 8 9 10; do
+    ./tools/dmqctl STATS > /dev/null 2>&1 && break
+    sleep 0.5
+done
+
+roms=$(ls "$IMAGES"/*.png 2>/dev/null | head -n 3 | sed 's|.*/||; s|\.png$||')
+clear_rtt=$(./dmq_bench -n 200 CLEAR) || status=1
+marquee_rtt=
+if [ -n "$roms" ]; then
+    marquee_rtt=$(./dmq_bench -n 60 $roms) || status=1
+fi
+reset_rtt=$(./dmq_bench -n 200 RESET) || status=1
+{
+    echo "CLEAR:    $clear_rtt"
+    [ -n "$roms" ] && echo "marquees: $marquee_rtt"
+    echo "RESET:    $reset_rtt"
+} > "$OUT/rtt.txt"
+
+./dmq_kmsbench -n "$REPS" -H "$card" > "$OUT/handover.json" || status=1
+
+{
+    ./tools/dmqctl STATS
+    ./tools/dmqctl MEM
+} > "$OUT/stats.txt"
+./tools/dmqctl EXIT > /dev/null
+wait "$pid" || status=1
+
+cat "$OUT/rtt.txt"
+grep "stage=crtc\|stage=scanout" "$OUT/stats.txt"
+echo "vkms_bench: results in $OUT/ ($([ $status = 0 ] && echo ok || echo FAILED))"
+exit $status
@@ -0,0 +1,54 @@
+#!/bin/sh
+# Regression check of the rendering path on the headless backend (make check): the daemon runs
+# with -H and raw frame dumps over the bundled images, at 32 bpp and at 16 bpp with dithering,
+# and every scanned-out frame is compared with the checksums in check/frames.sha256.
+#
+#   check/frames.sh            compare (exit 1 on a difference)
+#   check/frames.sh -u         rewrite check/frames.sha256 after an intended rendering change
+#
+# DMARQUEES and DMQCTL select the binaries (default ./dmarquees, ./tools/dmqctl).
+
+DMARQUEES=${DMARQUEES:-./dmarquees}
+DMQCTL=${DMQCTL:-./tools/dmqctl}
+SUMS=check/frames.sha256
+MODE=640x200@60
+ROMS="RetroPieMarquee RetroArch_logo MAMELogoR"
+
+work=$(mktemp -d) || exit 1
+trap 'rm -rf "$work"' EXIT
+
+# run NAME OPTIONS...: show every ROM, then CLEAR, dumping frames to $work/NAME
+run()
+{
+    name=$1
+    shift
+    mkdir -p "$work/$name"
+    rm -f /tmp/dmarquees.sock
+    "$DMARQUEES" -H "$MODE" -d "raw:$work/$name" -o "Virtual-1=images" "$@" > "$work/$name.log" 2>&1 &
+    pid=$!
+    for i in 1 2 3 4 5 6 7 8 9 10; do
+        "$DMQCTL" STATS > /dev/null 2>&1 && break
+        sleep 0.5
+    done
+    for rom in $ROMS CLEAR; do
+        "$DMQCTL" "$rom" > /dev/null || echo "frames: no reply to $rom ($name)" >&2
+    done
+    "$DMQCTL" EXIT > /dev/null
+    wait "$pid"
+}
+
+run bpp32
+run bpp16 -b 16 -D
+
+(cd "$work" && sha256sum */*.raw) > "$work/frames.sha256"
+if [ "$1" = "-u" ]; then
+    cp "$work/frames.sha256" "$SUMS"
+    echo "frames: $(wc -l < "$SUMS") frame checksums written to $SUMS"
+    exit 0
+fi
+if diff -u "$SUMS" "$work/frames.sha256"; then
+    echo "frames: $(wc -l < "$SUMS") frames match"
+else
+    echo "frames: rendered frames differ from $SUMS (check/frames.sh -u if intended)" >&2
+    exit 1
+fi
@@ -0,0 +1,60 @@
+#ifndef DISPLAY_H
+#define DISPLAY_H
+#include "helpers.h"
+#include <stdbool.h>
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+struct Image;
+
+/* One marquee display: connector/CRTC/mode, its dumb buffer and image routing */
+typedef struct
+{
+    int index;              // position in the output table (also in probe copies)
+    const char *want;       // connector requested with -o (NULL = first connected)
+    const char *image_dir;  // directory ROM marquees are loaded from
+    char name[32];          // connector name, e.g. "HDMI-A-2"
+    uint32_t conn_id;
+    uint32_t crtc_id;
+    int pipe;               // index of crtc_id in the device's CRTC list (vblank requests)
+    drmModeModeInfo mode;
+
+    /* DRM dumb buffer state */
+    uint32_t dumb_handle;
+    uint32_t fb_id;
+    uint32_t stride;
+    uint64_t bo_size;
+    void *fb_map;
+    PixelFormat format;     // layout of fb_map, negotiated with the primary plane
+
+    struct Image *image;    // image currently shown (NULL = black)
+} Output;
+
+/* Display backend: everything the daemon asks of the display hardware. The DRM backend
+   (dmarquees.c) drives g_device_path (-c); the headless backend (headless.c, -H WxH[@HZ])
+   renders into anonymous memory so the whole daemon runs on machines without a GPU. */
+typedef struct
+{
+    const char *name;
+    int (*open)(void);                      // 0, or -1 with errno set
+    void (*close)(void);
+    int (*find_connector_mode)(Output *out); // fill conn_id, crtc_id, mode and name; 0 or -1
+    int (*create_fb)(Output *o);            // fill fb_id, fb_map, stride, bo_size, format; 0 or -1
+    void (*destroy_fb)(Output *o);
+    bool (*acquire)(void);                  // become master; false with errno set
+    bool (*release)(void);                  // drop master; false with errno set
+    int (*set_crtc)(Output *o);             // scan out o->fb_id; 0, or -1 with errno set
+
+    /* Ask for the next vblank on o's CRTC: display_vblank(data, ...) is called once it has
+       happened (from handle_events, or before request_vblank returns). 0, or -1 with errno set */
+    int (*request_vblank)(Output *o, void *data);
+    int (*event_fd)(void);                  // fd the event loop polls for handle_events, or -1
+    void (*handle_events)(void);
+} DisplayBackend;
+
+extern const DisplayBackend headless_backend;
+
+// Vblank requested with request_vblank() happened at vblank_us (monotonic_us() clock); dmarquees.c
+void display_vblank(void *data, uint64_t vblank_us);
+
+#endif
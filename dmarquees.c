@@ -3,8 +3,13 @@
 
  Lightweight DRM marquee daemon for Raspberry Pi / RetroPie.
  - Runs as a long-lived daemon (run as root at boot).
- - Owns /dev/dri/card1 (attempts drmSetMaster) and modesets the chosen connector.
- - Listens on a named FIFO /tmp/dmarquee_cmd for commands written by your plugin.
+ - Owns /dev/dri/card1 (-c selects another card; attempts drmSetMaster) and modesets the chosen
+   connector(s).
+ - Listens on a named FIFO /tmp/dmarquee_cmd for commands written by your plugin. The FIFO
+   is opened once and served from a single epoll loop together with signals (signalfd) and
+   hotplug uevents, so commands are acted on immediately and the idle daemon never wakes up.
+ - When a CRTC reset fails because RetroArch/MAME owns the display, a timerfd retries it with
+   exponential backoff (250 ms doubling to a 4 s cap) and is cancelled on the first success.
  - Commands:
      <shortname>   => load /home/danc/mnt/marquees/<shortname>.png and display it
      CLEAR         => clear the screen (black)
@@ -12,10 +17,95 @@
      RA            => set frontend mode to RetroArch
      SA            => set frontend mode to StandAlone
      RESET         => reset the CRTC (re-acquire display)
+     HOTPLUG       => inject a synthetic DRM hotplug uevent (re-probe connectors)
+     PREFETCH <shortname> => decode the marquee into the image cache without showing it
+     STATS         => per-stage latency p50/p95/p99/max and cache hits (socket reply or log)
+     MEM           => bytes held by decoded images, framebuffers, staging buffers and rings
+   Any command may be prefixed with "<n>:" to target only output n (e.g. "1:sf"),
+   otherwise it applies to every output. Commands are newline terminated; several may be
+   written at once. Of a burst of queued display commands (ROM names, CLEAR) only the newest
+   per output is rendered, control commands (EXIT, RESET, RA/SA/NA, ...) all run in order.
+ - The same commands are accepted on a SOCK_SEQPACKET Unix socket /tmp/dmarquees.sock, one per
+   packet. Each gets one reply packet with a status and latency breakdown, e.g.
+     SHOWN sf total_us=41234 queue_us=12 stat_us=40 decode_us=35012 blit_us=5980 crtc_us=190 crtc=ok
+   Status is OK, SHOWN, MISSING, FAILED, SKIPPED_MULTISCREEN, SUPERSEDED or BAD_OUTPUT; crtc=pending
+   means the display is owned by another master and will be reacquired. Any number of clients
+   can be connected; they are served from the same event loop as the FIFO, which remains.
+ - Plugins that post commands in a tight loop can skip the fork/exec of "echo" with the
+   shared-memory ring /dev/shm/dmarquees.ring and its client library (dmq_ring.h, in
+   libdmarquees.a/.so): dmq_client_open() once, then dmq_client_post(&c, "sf") is a few
+   atomic ops; an eventfd write is only needed when the daemon is idle. Ring commands are
+   coalesced and dispatched with the FIFO's (no reply).
+ - PREFETCH runs on a background worker at SCHED_IDLE (on the daemon's core with -R PRIO@CPU),
+   paused while the display is owned by MAME/RetroArch, so cache warming never costs the
+   emulator frames.
+ - Prometheus metrics (command counts by type, stage latency histograms, CRTC reset failures,
+   cache entries/bytes, time since the last successful scanout) are served on the stream
+   socket /tmp/dmarquees.metrics (e.g. "socat - UNIX-CONNECT:/tmp/dmarquees.metrics"); with
+   -M FILE they are also rewritten atomically every 15 s for node-exporter's textfile collector.
+ - The last 8 decoded images are kept in an LRU cache (invalidated when the PNG changes), so
+   PREFETCH or a repeated ROM skips the decode. libdmarquees (dmq_client.h) wraps the control
+   socket in a persistent connection: dmq_show(), dmq_mode(), dmq_clear(), dmq_prefetch().
+   tools/dmqctl is a command-line client, dmq_bench measures round-trip p50/p99, and
+   "make bench" times decode, scale/blit and command parsing (median/MAD, JSON).
+ - Decoding and blitting run on a render worker thread, so the event loop keeps accepting
+   commands while a large PNG is decoded. A newer display command cancels any queued or
+   in-flight render covering the same outputs (checked between row batches of the decode and
+   the blit); the cancelled command is answered SUPERSEDED and its image is never shown.
+ - PNG files are read through io_uring (uring_reader.c): four 256 KB reads stay in flight ahead
+   of libpng, so SD-card / fuse-zip latency overlaps with the decode instead of stalling it.
+   Falls back to stdio where io_uring is unavailable. Idle rings and their buffers are pooled
+   and reused by the next decode rather than set up per file.
+ - Logging is asynchronous (log.c): ts_printf() and friends copy the format pointer, arguments
+   and a raw timestamp into a per-thread ring and a writer thread formats and flushes them, so
+   the render and command paths never block on the console. -L debug|info|warn|error filters
+   by level (default info; CRTC master chatter is debug).
  - Image is scaled nearest-neighbor to fit the screen width while preserving aspect ratio.
- - Uses a single persistent dumb framebuffer; the daemon blits into the mapped buffer
-   and calls drmModeSetCrtc() once at startup to show the FB. Subsequent blits update
+ - Uses a single persistent dumb framebuffer per output; the daemon blits into the mapped
+   buffer and calls drmModeSetCrtc() once at startup to show the FB. Subsequent blits update
    the same FB memory (the kernel presents the updated contents).
+ - The FB format is negotiated with the primary plane's IN_FORMATS: XBGR8888 matches libpng's
+   RGBA byte order so pixels are stored without channel shuffling (XRGB8888 as fallback).
+   With -b 16 an RGB565 framebuffer halves scanout and blit bandwidth (leaving more memory
+   bandwidth to the emulator); -D adds 4x4 ordered dithering to hide the 16-bit banding.
+ - With -R PRIO[@CPU] (e.g. -R 10@3) the command and render threads run at SCHED_FIFO PRIO,
+   pinned to CPU, with mlockall() and a pre-faulted heap: a marquee update while MAME
+   saturates every core during launch no longer lags by hundreds of milliseconds.
+ - A static marquee does not need 60 Hz: "-r min" picks the lowest refresh rate the panel offers
+   at the chosen resolution, "-r 24" (or 30, ...) the closest to that rate.
+ - Several marquee panels can be driven at once with repeated -o options, e.g.
+     dmarquees -o HDMI-A-1 -o HDMI-A-2=/home/danc/mnt/cards
+   Each output has its own framebuffer and image directory. A PNG is decoded once for all
+   outputs that use it, outputs with the same mode share one scaled blit, and the per-output
+   work runs in parallel. Without -o the first connected output is used (as before).
+ - Display calls go through a backend (display.h). With -H WxH[@HZ] the headless backend
+   (headless.c) replaces /dev/dri/card1 with anonymous framebuffers, so the whole daemon (FIFO,
+   socket, cache, scaling) runs on machines without a GPU; -d DIR dumps every scanout as PNG
+   (-d raw:DIR as raw framebuffer bytes), e.g.
+     dmarquees -H 1920x480 -d /tmp/frames -o Virtual-1=./images
+   "make check" renders the bundled images this way and compares the frames with checksums.
+ - -T FILE records every received command with its receipt time (and source) to a trace;
+   tools/dmqreplay plays a trace back into the socket or FIFO at the original pace, N times
+   faster or as fast as possible, and reports end-to-end latency percentiles and throughput.
+ - -P FILE writes a timeline of every command (receipt to reply), decode, clear/blit, CRTC
+   reset and cache hit/miss/eviction in Chrome trace JSON, to open in ui.perfetto.dev or
+   chrome://tracing. Events go to a lock-free in-memory ring; a background thread writes them.
+ - Display latency: after each rendered command a vblank event is requested on its outputs
+   (drmWaitVBlank, read from the DRM fd in the event loop), and the time from command receipt
+   to the kernel's timestamp of that vblank - the first frame scanning out the whole new image -
+   is the "scanout" stage of STATS and the metrics. The headless backend uses ticks of -H's HZ.
+ - Memory is accounted by pool (decoded images, framebuffers, PNG rows and io_uring buffers,
+   log/timeline/command rings) and reported by MEM and the metrics. -m MB (default 128, 0 = off)
+   is a budget for all of it: cached images nobody is showing are evicted to stay under it, and
+   a PNG whose decoded size cannot fit next to the framebuffers is refused (default marquee).
+ - "make vkms-bench" (root) runs the real DRM path on the kernel's virtual KMS driver: it loads
+   vkms, runs dmarquees on its card (-c /dev/dri/cardN), times KMS ioctls, checks the scanout
+   through debugfs CRCs and hands the display to another master and back (bench/vkms_bench.sh).
+ - Subscribes to kernel uevents on a netlink socket; a DRM hotplug event (monitor
+   power-cycled or replugged) re-probes the connectors, re-creates an FB if its mode
+   changed and redraws the current marquee from the decoded image still in memory.
+   A real synthetic event can also be raised from the shell:
+     echo "change $(cat /proc/sys/kernel/random/uuid) HOTPLUG=1" > /sys/class/drm/card1/uevent
 
  Build:
    sudo apt update
@@ -30,30 +120,50 @@
 */
 
 #define _GNU_SOURCE
+#include "display.h"
+#include "dmq_client.h"
+#include "dmq_ring.h"
+#include "evloop.h"
 #include "helpers.h"
+#include "log.h"
+#include "stats.h"
+#include "trace.h"
 #include <drm/drm.h>
+#include <drm/drm_fourcc.h>
 #include <drm/drm_mode.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <malloc.h>
+#include <linux/netlink.h>
 #include <png.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/eventfd.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <unistd.h>
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 
 #define VERSION "1.5.1"
-#define DEVICE_PATH "/dev/dri/card1"
 #define IMAGE_DIR "/home/danc/mnt/marquees"
-#define CMD_FIFO "/tmp/dmarquees_cmd"
+#define METRICS_SOCK "/tmp/dmarquees.metrics"
+#define METRICS_INTERVAL_SEC 15     // -M textfile rewrite period
+#define METRICS_BUF_SIZE 32768
+#define TRACE_HEADER "# dmarquees trace v1: <us> <fifo|sock|ring> <command>"
 #define PROGRAM_DIR "/home/danc/marquees"
 #define DEF_MARQUEE_DIR PROGRAM_DIR "/images"
 #define DEF_MARQUEE_NAME "RetroPieMarquee"
@@ -61,496 +171,2419 @@
 #define DEF_SA_MARQUEE_NAME "MAMELogoR"
 #define PREFERRED_W 1920
 #define PREFERRED_H 1080
-#define FIFO_RETRY_DELAY_MSEC 250
-#define CRTC_RESET_HOLD_SEC   10
+#define CMD_BUF_SIZE 1024
+#define CMD_BATCH_MAX 64
+#define CMD_MAX_LEN 256
+#define SOCK_BACKLOG 16
+#define CRTC_RETRY_MIN_MSEC   250
+#define CRTC_RETRY_MAX_MSEC   4000
+#define ALL_OUTPUTS ((1u << MAX_OUTPUTS) - 1)
+#define IMAGE_CACHE_MAX 8   // decoded images kept for PREFETCH / repeated ROMs
+#define RT_HEAP_PREFAULT (24 << 20)     // -R: heap faulted in and locked up front (decode buffers)
+#define RT_STACK_PREFAULT (256 << 10)
+
+/* Decoded RGBA image, shared by every output currently showing it and the image cache */
+typedef struct Image
+{
+    char path[512];
+    uint8_t *rgba;
+    int w;
+    int h;
+    time_t mtime;       // of the PNG when decoded; a cached image is stale once the file changes
+    off_t size;
+    atomic_int refs;
+} Image;
+
+static bool running = true;
+static int drm_fd = -1;
+static const DisplayBackend *display;   // DRM device, or headless with -H
+
+static Output outputs[MAX_OUTPUTS];
+static int num_outputs = 0;
+
+/* Event sources of the main loop */
+static int fifo_fd = -1;     // command FIFO, opened once
+static int signal_fd = -1;   // SIGINT/SIGTERM
+static int uevent_fd = -1;   // kernel uevent netlink socket (DRM hotplug notifications)
+static int reacquire_fd = -1; // timerfd for CRTC reacquisition
+
+static int sock_fd = -1;      // SOCK_SEQPACKET control socket (listening)
+static int metrics_fd = -1;   // SOCK_STREAM Prometheus metrics socket (listening)
+static int metrics_timer_fd = -1; // timerfd for the -M textfile
+
+/* Counters exported as metrics (main thread only) */
+static uint64_t command_counts[CMD_TYPE_COUNT];
+static uint64_t crtc_failures_total = 0;
+static uint64_t last_scanout_us = 0;    // last fully successful CRTC set, 0 = never
+
+/* A command's frame waiting for the vblank that first scans it out (STAGE_SCANOUT) */
+typedef struct
+{
+    uint64_t recv_us;
+    int output;
+} ScanoutWait;
+
+#define MAX_SCANOUT_WAITS 64    // vblank requests in flight; more are not measured
+static int scanout_waits = 0;
+static bool vblank_events = true; // cleared when the backend refuses a vblank request
+
+/* Newline-delimited commands read from the FIFO; a partial line waits for its newline */
+static char cmd_buf[CMD_BUF_SIZE];
+static size_t cmd_len = 0;
+
+/* Outcome and latency breakdown of the command being dispatched (reported on the control socket) */
+typedef struct
+{
+    CmdStatus status;
+    bool crtc_ok;
+    uint64_t recv_us;   // monotonic receipt time
+    uint64_t start_us;  // dispatch start
+    uint64_t stat_us;
+    uint64_t decode_us;
+    uint64_t blit_us;
+    uint64_t crtc_us;
+    const char *body;   // extra reply lines (STATS)
+} CmdResult;
+
+/* Command trace (-T) */
+static FILE *trace_fp = NULL;
+static uint64_t trace_t0 = 0;   // receipt time of the first traced command
+static uint64_t trace_cmd_id = 0; // async span ids of the timeline (-P)
+
+/* Commands received since the last dispatch round, from the FIFO and the control socket */
+typedef struct
+{
+    char cmd[CMD_MAX_LEN];  // trimmed command
+    int client_fd;          // control socket client to reply to, -1 for FIFO commands
+    uint64_t recv_us;
+} QueuedCommand;
+
+static QueuedCommand cmd_queue[CMD_BATCH_MAX];
+static int cmd_queue_len = 0;
+
+/* Output images and framebuffers are shared by the render worker and the main thread (hotplug) */
+static pthread_mutex_t outputs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Job queues (see RenderJob), each served by one worker thread: pending jobs and the job being
+   executed. Finished jobs of both queues wait on the done list for the main thread to set the
+   CRTC and reply. Everything here is guarded by job_lock. */
+struct RenderJob;
+typedef struct
+{
+    const char *name;
+    pthread_cond_t cond;
+    struct RenderJob *head, *tail;
+    struct RenderJob *current;
+    bool paused;            // hold off starting new jobs
+    bool started;
+    pthread_t tid;
+} JobQueue;
+
+static pthread_mutex_t job_lock = PTHREAD_MUTEX_INITIALIZER;
+static JobQueue render_q = {.name = "render", .cond = PTHREAD_COND_INITIALIZER};         // display jobs
+static JobQueue background_q = {.name = "background", .cond = PTHREAD_COND_INITIALIZER}; // prefetch, SCHED_IDLE
+static struct RenderJob *done_head = NULL, *done_tail = NULL;
+static bool worker_quit = false;
+static int job_done_fd = -1;  // eventfd: workers -> main loop
+
+/* Shared-memory command ring for in-process plugins (see dmq_ring.h) */
+static DmqRing *cmd_ring = NULL;
+static int ring_fd = -1;      // eventfd kicked by ring producers while the loop sleeps
+
+/* CRTC reacquisition: outputs whose CRTC could not be set (display owned by RetroArch/MAME)
+   are retried from a timerfd with exponential backoff capped at CRTC_RETRY_MAX_MSEC. */
+static uint32_t reacquire_pending = 0;
+static int reacquire_delay_ms = 0;  // current backoff, 0 = timer idle
+
+static void arm_reacquire_timer(int ms)
+{
+    struct itimerspec its = {0};
+    its.it_value.tv_sec = ms / 1000;
+    its.it_value.tv_nsec = (long)(ms % 1000) * 1000000L;
+    if (reacquire_fd >= 0 && timerfd_settime(reacquire_fd, 0, &its, NULL) != 0)
+        ts_perror("timerfd_settime");
+}
+
+/* Background work must never cost the emulator frames: the background queue is paused while
+   the display is owned by MAME/RetroArch (a CRTC reset failed and reacquisition is pending). */
+static void set_background_paused(bool paused)
+{
+    pthread_mutex_lock(&job_lock);
+    if (background_q.paused != paused)
+    {
+        background_q.paused = paused;
+        ts_printf("dmarquees: background work %s\n", paused ? "paused" : "resumed");
+        pthread_cond_signal(&background_q.cond);
+    }
+    pthread_mutex_unlock(&job_lock);
+}
+
+// Try to reset the CRTCs of the outputs in mask by becoming master, setting each CRTC,
+// then dropping master. Returns true if every drmModeSetCrtc succeeded. Failed outputs are
+// queued for reacquisition; the retry timer is cancelled once nothing is pending.
+static bool try_reset_crtc(uint32_t mask)
+{
+    ts_debug("dmarquees: trying CRTC reset\n");
+
+    uint64_t t0 = monotonic_us();
+    uint32_t ok = 0, failed = 0;
+    bool got_master = display->acquire();
+    if (!got_master)
+        ts_perror("drmSetMaster (try_reset_crtc)");
+    else
+        ts_debug("dmarquees: master set\n");
+
+    for (int i = 0; i < num_outputs; ++i)
+    {
+        Output *o = &outputs[i];
+        if (!(mask & (1u << i)) || !o->fb_id)
+            continue;
+
+        if (display->set_crtc(o) != 0)
+        {
+            ts_perror("drmModeSetCrtc (try_reset_crtc)");
+            failed |= 1u << i;
+        }
+        else
+        {
+            ts_printf("dmarquees: crtc reset success! (%s)\n", o->name);
+            ok |= 1u << i;
+        }
+    }
+
+    if (got_master)
+    {
+        if (!display->release())
+            ts_perror("drmDropMaster (try_reset_crtc)");
+        else
+            ts_debug("dmarquees: master dropped\n");
+    }
+
+    reacquire_pending = (reacquire_pending & ~ok) | failed;
+    set_background_paused(reacquire_pending != 0);
+    if (!reacquire_pending && reacquire_delay_ms)
+    {
+        arm_reacquire_timer(0); // disarm
+        reacquire_delay_ms = 0;
+        ts_printf("dmarquees: display reacquired, retry timer cancelled\n");
+    }
+    else if (reacquire_pending && !reacquire_delay_ms)
+    {
+        reacquire_delay_ms = CRTC_RETRY_MIN_MSEC;
+        arm_reacquire_timer(reacquire_delay_ms);
+    }
+    stats_record(STAGE_CRTC, monotonic_us() - t0);
+    trace_span("display", failed ? "crtc reset (failed)" : "crtc reset", t0, monotonic_us(), NULL);
+    if (failed)
+        crtc_failures_total++;
+    else if (ok)
+        last_scanout_us = monotonic_us();
+    return failed == 0;
+}
+
+/* Measure command-to-scanout latency for the outputs in mask, just set up for a command
+   received at recv_us. Dumb buffers are scanned out in place, so the first vblank after the
+   blit and the CRTC set starts the first frame showing the whole new image. */
+static void request_scanout(uint32_t mask, uint64_t recv_us)
+{
+    for (int i = 0; i < num_outputs && vblank_events; ++i)
+    {
+        if (!(mask & (1u << i)) || !outputs[i].fb_id || scanout_waits >= MAX_SCANOUT_WAITS)
+            continue;
+        ScanoutWait *w = malloc(sizeof(*w));
+        if (!w)
+            return;
+        w->recv_us = recv_us;
+        w->output = i;
+        scanout_waits++;
+        if (display->request_vblank(&outputs[i], w) != 0)
+        {
+            ts_perror("drmWaitVBlank");
+            ts_fprintf(stderr, "warning: no vblank events, scanout latency is not measured\n");
+            vblank_events = false;
+            scanout_waits--;
+            free(w);
+        }
+    }
+}
+
+void display_vblank(void *data, uint64_t vblank_us)
+{
+    ScanoutWait *w = data;
+    scanout_waits--;
+    if (vblank_us < w->recv_us)
+        vblank_us = w->recv_us;
+    stats_record(STAGE_SCANOUT, vblank_us - w->recv_us);
+    trace_async("display", "scanout", ++trace_cmd_id, w->recv_us, vblank_us, outputs[w->output].name);
+    free(w);
+}
+
+// Vblank events arrived on the display fd (event loop handler)
+static void on_display_event(int fd, uint32_t events, void *ctx)
+{
+    (void)fd;
+    (void)events;
+    (void)ctx;
+    display->handle_events();
+}
+
+// CRTC reacquisition timer expired (event loop handler)
+static void on_reacquire_timer(int fd, uint32_t events, void *ctx)
+{
+    (void)events;
+    (void)ctx;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) != sizeof(expirations) || !reacquire_pending)
+        return;
+
+    ts_printf("dmarquees: retrying crtc now (backoff %d ms)...\n", reacquire_delay_ms);
+
+    // double the backoff before retrying so a failure re-arms with the longer delay
+    int next = reacquire_delay_ms * 2;
+    reacquire_delay_ms = next < CRTC_RETRY_MAX_MSEC ? next : CRTC_RETRY_MAX_MSEC;
+    if (!try_reset_crtc(reacquire_pending))
+        arm_reacquire_timer(reacquire_delay_ms);
+}
+
+// Pick default marquee name based on frontend mode
+static const char *default_marquee_name_for(FrontendMode m)
+{
+    switch (m)
+    {
+    case eSA: return DEF_SA_MARQUEE_NAME;
+    case eRA: return DEF_RA_MARQUEE_NAME;
+    case eNA:
+    default:  return DEF_MARQUEE_NAME;
+    }
+}
+
+static void image_unref(Image *img)
+{
+    if (img && atomic_fetch_sub(&img->refs, 1) == 1)
+    {
+        stats_mem_add(MEM_IMAGES, -(int64_t)img->w * img->h * 4);
+        free(img->rgba);
+        free(img);
+    }
+}
+
+// Point an output at a new image (or NULL), dropping its reference to the old one
+static void output_set_image(Output *o, Image *img)
+{
+    if (img)
+        atomic_fetch_add(&img->refs, 1);
+    image_unref(o->image);
+    o->image = img;
+}
+
+/* LRU cache of decoded images (most recently used first); each entry holds a reference */
+static Image *image_cache[IMAGE_CACHE_MAX];
+static int image_cache_len = 0;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Cached image for path if the file is unchanged (st), with a reference taken; NULL on a miss
+static Image *cache_get(const char *path, const struct stat *st)
+{
+    Image *img = NULL;
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < image_cache_len; ++i)
+    {
+        Image *c = image_cache[i];
+        if (strcmp(c->path, path) != 0)
+            continue;
+        if (c->mtime == st->st_mtime && c->size == st->st_size)
+        {
+            img = c;
+            atomic_fetch_add(&img->refs, 1);
+            memmove(&image_cache[1], &image_cache[0], i * sizeof(Image *));
+            image_cache[0] = img;
+        }
+        else
+        {
+            image_unref(c); // file replaced on disk
+            memmove(&image_cache[i], &image_cache[i + 1], (--image_cache_len - i) * sizeof(Image *));
+        }
+        break;
+    }
+    pthread_mutex_unlock(&cache_lock);
+    return img;
+}
+
+// Drop cache entry i (caller holds cache_lock)
+static void cache_evict(int i, const char *why)
+{
+    trace_instant("cache", why, image_cache[i]->path);
+    image_unref(image_cache[i]);
+    memmove(&image_cache[i], &image_cache[i + 1], (--image_cache_len - i) * sizeof(Image *));
+}
+
+/* Over the -m budget, evict the oldest entries only the cache holds (not shown anywhere) until
+   it fits; the newest entry stays (caller holds cache_lock) */
+static void cache_trim_locked(void)
+{
+    for (int i = image_cache_len - 1; i > 0 && g_mem_budget && stats_mem_total() > g_mem_budget; --i)
+    {
+        if (atomic_load(&image_cache[i]->refs) == 1)
+            cache_evict(i, "cache evict (budget)");
+    }
+}
+
+static void cache_trim(void)
+{
+    pthread_mutex_lock(&cache_lock);
+    cache_trim_locked();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Insert a freshly decoded image, evicting the least recently used one when full or over budget
+static void cache_put(Image *img)
+{
+    pthread_mutex_lock(&cache_lock);
+    if (image_cache_len == IMAGE_CACHE_MAX)
+        cache_evict(image_cache_len - 1, "cache evict");
+    memmove(&image_cache[1], &image_cache[0], image_cache_len * sizeof(Image *));
+    image_cache[0] = img;
+    image_cache_len++;
+    atomic_fetch_add(&img->refs, 1);
+    cache_trim_locked();
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Entries and decoded bytes held by the cache
+static uint64_t cache_bytes(int *entries)
+{
+    uint64_t bytes = 0;
+    pthread_mutex_lock(&cache_lock);
+    for (int i = 0; i < image_cache_len; ++i)
+        bytes += (uint64_t)image_cache[i]->w * image_cache[i]->h * 4;
+    *entries = image_cache_len;
+    pthread_mutex_unlock(&cache_lock);
+    return bytes;
+}
+
+static void cache_clear(void)
+{
+    pthread_mutex_lock(&cache_lock);
+    while (image_cache_len > 0)
+        image_unref(image_cache[--image_cache_len]);
+    pthread_mutex_unlock(&cache_lock);
+}
+
+// Run fn(args[0..n-1]) with one thread per element; element 0 runs on the calling thread
+static void run_parallel(void *(*fn)(void *), void *args, size_t arg_size, int n)
+{
+    pthread_t tids[MAX_OUTPUTS];
+    bool started[MAX_OUTPUTS] = {false};
+
+    for (int i = 1; i < n; ++i)
+    {
+        void *arg = (char *)args + (size_t)i * arg_size;
+        started[i] = pthread_create(&tids[i], NULL, fn, arg) == 0;
+        if (!started[i])
+            fn(arg); // could not spawn: do the work inline
+    }
+    if (n > 0)
+        fn(args);
+    for (int i = 1; i < n; ++i)
+    {
+        if (started[i])
+            pthread_join(tids[i], NULL);
+    }
+}
+
+/* Blit work for a group of outputs showing the same image at the same mode: the image is
+   scaled once into the first output's buffer and copied into the others. */
+typedef struct
+{
+    Output *members[MAX_OUTPUTS];
+    int count;
+    const CancelToken *cancel;
+} BlitGroup;
+
+static void *blit_group(void *arg)
+{
+    BlitGroup *g = arg;
+    Output *lead = g->members[0];
+
+    // Clear screen before blit (to avoid remnants)
+    uint64_t t0 = monotonic_us();
+    memset(lead->fb_map, 0x00, lead->bo_size);
+    uint64_t t1 = monotonic_us();
+    stats_record(STAGE_CLEAR, t1 - t0);
+    trace_span("render", "clear", t0, t1, lead->name);
+    if (lead->image)
+    {
+        scale_and_blit_to_xrgb(lead->image->rgba, lead->image->w, lead->image->h, lead->fb_map, lead->mode.hdisplay,
+                               lead->mode.vdisplay, lead->stride / (pixel_format_bpp(lead->format) / 8), 0,
+                               lead->format, g_dither, g->cancel);
+        stats_record(STAGE_BLIT, monotonic_us() - t1);
+        trace_span("render", "blit", t1, monotonic_us(), lead->name);
+    }
+
+    for (int i = 1; i < g->count && !is_cancelled(g->cancel); ++i)
+        memcpy(g->members[i]->fb_map, lead->fb_map, lead->bo_size);
+    return NULL;
+}
+
+// Clear and redraw the current image of every output in mask (caller holds outputs_lock)
+static void draw_outputs(uint32_t mask, const CancelToken *cancel)
+{
+    BlitGroup groups[MAX_OUTPUTS];
+    int ngroups = 0;
+
+    for (int i = 0; i < num_outputs; ++i)
+    {
+        Output *o = &outputs[i];
+        if (!(mask & (1u << i)) || !o->fb_map)
+            continue;
+
+        int g = 0;
+        for (; g < ngroups; ++g)
+        {
+            Output *lead = groups[g].members[0];
+            if (lead->image == o->image && lead->mode.hdisplay == o->mode.hdisplay &&
+                lead->mode.vdisplay == o->mode.vdisplay && lead->stride == o->stride && lead->bo_size == o->bo_size &&
+                lead->format == o->format)
+                break;
+        }
+        if (g == ngroups)
+        {
+            groups[ngroups].count = 0;
+            groups[ngroups++].cancel = cancel;
+        }
+        groups[g].members[groups[g].count++] = o;
+    }
+
+    run_parallel(blit_group, groups, sizeof(groups[0]), ngroups);
+}
+
+/* Decode job for one distinct image path; image is returned with a reference held by the job */
+typedef struct
+{
+    const char *path;
+    Image *image;
+    const CancelToken *cancel;
+} DecodeJob;
+
+static void *decode_job(void *arg)
+{
+    DecodeJob *job = arg;
+    struct stat st;
+
+    job->image = NULL;
+    if (stat(job->path, &st) != 0)
+        return NULL;
+    job->image = cache_get(job->path, &st);
+    stats_cache_access(job->image != NULL);
+    trace_instant("cache", job->image ? "cache hit" : "cache miss", job->path);
+    if (job->image)
+        return NULL;
+
+    int w = 0, h = 0;
+    uint64_t t0 = monotonic_us();
+    uint8_t *rgba = load_png_rgba(job->path, &w, &h, job->cancel);
+    trace_span("render", rgba ? "decode" : "decode (failed)", t0, monotonic_us(), job->path);
+    if (!rgba)
+        return NULL;
+    stats_record(STAGE_DECODE, monotonic_us() - t0);
+
+    job->image = calloc(1, sizeof(Image));
+    if (!job->image)
+    {
+        stats_mem_add(MEM_IMAGES, -(int64_t)w * h * 4);
+        free(rgba);
+        return NULL;
+    }
+    snprintf(job->image->path, sizeof(job->image->path), "%s", job->path);
+    job->image->rgba = rgba;
+    job->image->w = w;
+    job->image->h = h;
+    job->image->mtime = st.st_mtime;
+    job->image->size = st.st_size;
+    atomic_init(&job->image->refs, 1);
+    cache_put(job->image);
+    return NULL;
+}
+
+/* Decode paths[i] for every output i in mask, each distinct path once and in parallel (cache hits
+   skip the decode). Fills jobs/job_of and returns the number of jobs; the caller releases the
+   job references with release_decoded(). */
+static int decode_paths(uint32_t mask, char paths[][512], const CancelToken *cancel, DecodeJob *jobs, int *job_of,
+                        CmdResult *res)
+{
+    int njobs = 0;
+
+    for (int i = 0; i < num_outputs; ++i)
+    {
+        if (!(mask & (1u << i)))
+            continue;
+        int j = 0;
+        while (j < njobs && strcmp(jobs[j].path, paths[i]) != 0)
+            ++j;
+        if (j == njobs)
+        {
+            jobs[njobs].cancel = cancel;
+            jobs[njobs++].path = paths[i];
+        }
+        job_of[i] = j;
+    }
+
+    uint64_t t0 = monotonic_us();
+    run_parallel(decode_job, jobs, sizeof(jobs[0]), njobs);
+    res->decode_us += monotonic_us() - t0;
+    return njobs;
+}
+
+static void release_decoded(DecodeJob *jobs, int njobs)
+{
+    for (int j = 0; j < njobs; ++j)
+        image_unref(jobs[j].image);
+}
+
+/* Decode paths[i] for every output i in mask, assign the images and redraw those outputs.
+   Returns the mask of outputs whose image failed to load; those outputs are left black.
+   outputs_lock is only taken for the image swap and blit, so a slow decode never blocks the
+   main loop. Nothing is drawn if cancel fires during the decode. */
+static uint32_t load_and_draw(uint32_t mask, char paths[][512], const CancelToken *cancel, CmdResult *res)
+{
+    DecodeJob jobs[MAX_OUTPUTS];
+    int job_of[MAX_OUTPUTS];
+    int njobs = decode_paths(mask, paths, cancel, jobs, job_of, res);
+
+    if (is_cancelled(cancel))
+    {
+        release_decoded(jobs, njobs);
+        return 0;
+    }
+
+    pthread_mutex_lock(&outputs_lock);
+    uint32_t failed = 0;
+    for (int i = 0; i < num_outputs; ++i)
+    {
+        if (!(mask & (1u << i)))
+            continue;
+        Image *img = jobs[job_of[i]].image;
+        if (!img)
+            failed |= 1u << i;
+        output_set_image(&outputs[i], img);
+    }
+
+    uint64_t t0 = monotonic_us();
+    draw_outputs(mask, cancel);
+    res->blit_us += monotonic_us() - t0;
+    pthread_mutex_unlock(&outputs_lock);
+    release_decoded(jobs, njobs);
+    cache_trim(); // the images replaced on screen may now be evictable
+    return failed;
+}
+
+// Path of the default marquee for the current frontend mode
+static void default_marquee_path(char *buf, size_t size)
+{
+    snprintf(buf, size, "%s/%s.png", DEF_MARQUEE_DIR, default_marquee_name_for(g_frontend_mode));
+}
+
+/* Render job: everything that changes what an output shows (ROM marquee, default marquee) runs
+   on the render worker thread, one job at a time in submission order. Prefetches use the same
+   job type on the background worker. */
+typedef enum
+{
+    JOB_DEFAULT,
+    JOB_ROM,
+    JOB_PREFETCH    // decode the ROM marquee into the image cache without drawing it
+} JobKind;
+
+typedef struct RenderJob
+{
+    JobKind kind;
+    uint32_t mask;              // outputs to draw
+    char rom[CMD_MAX_LEN];      // JOB_ROM, JOB_PREFETCH: shortname
+    char default_path[512];     // default marquee (also the fallback for a missing ROM image)
+    atomic_bool cancelled;      // set when a newer job covering the same outputs is submitted
+
+    /* written by the worker, read by the main thread once the job is on the done list */
+    bool completed;             // drawn without being cancelled
+    uint32_t drawn;             // outputs whose CRTC should now be set
+    CmdResult res;
+
+    /* main thread only */
+    int client_fd;              // control socket client awaiting the reply, -1 for none
+    char cmd[CMD_MAX_LEN];      // command echoed in the reply
+
+    struct RenderJob *next;
+} RenderJob;
+
+// Worker side of a job: stat and decode the images, swap them in and blit
+static void execute_job(RenderJob *job)
+{
+    CancelToken tok = {&job->cancelled};
+    char paths[MAX_OUTPUTS][512];
+    uint32_t mask = job->mask & ((1u << num_outputs) - 1);
+    uint32_t missing = 0;
+    uint64_t t0 = monotonic_us();
+
+    for (int i = 0; i < num_outputs; ++i)
+    {
+        if (!(mask & (1u << i)))
+            continue;
+        snprintf(paths[i], sizeof(paths[i]), "%s", job->default_path);
+        if (job->kind == JOB_DEFAULT)
+            continue;
+
+        char rom_path[512];
+        snprintf(rom_path, sizeof(rom_path), "%s/%s.png", outputs[i].image_dir, job->rom);
+        struct stat st;
+        if (stat(rom_path, &st) != 0)
+        {
+            ts_fprintf(stderr, "warning: image missing: %s\n", rom_path);
+            missing |= 1u << i; // falls back to the default marquee
+        }
+        else
+            snprintf(paths[i], sizeof(paths[i]), "%s", rom_path);
+    }
+    if (job->kind != JOB_DEFAULT)
+    {
+        job->res.stat_us += monotonic_us() - t0;
+        stats_record(STAGE_STAT, monotonic_us() - t0);
+        job->res.status = missing ? ST_MISSING : ST_SHOWN;
+    }
+
+    if (job->kind == JOB_PREFETCH)
+    {
+        DecodeJob jobs[MAX_OUTPUTS];
+        int job_of[MAX_OUTPUTS];
+        int njobs = decode_paths(mask & ~missing, paths, &tok, jobs, job_of, &job->res);
+        job->res.status = missing ? ST_MISSING : ST_OK;
+        for (int j = 0; j < njobs; ++j)
+        {
+            if (!jobs[j].image && !is_cancelled(&tok))
+            {
+                ts_error("error: png load failed %s\n", jobs[j].path);
+                job->res.status = ST_FAILED;
+            }
+        }
+        release_decoded(jobs, njobs); // the cache keeps its reference
+        if (!is_cancelled(&tok))
+        {
+            ts_printf("dmarquees: prefetched %s\n", job->rom);
+            job->completed = true;
+        }
+        return;
+    }
+
+    uint32_t failed = load_and_draw(mask, paths, &tok, &job->res);
+    if (is_cancelled(&tok))
+        return;
+
+    if (job->kind == JOB_ROM && (failed & ~missing))
+    {
+        for (int i = 0; i < num_outputs; ++i)
+        {
+            if (failed & ~missing & (1u << i))
+            {
+                ts_error("error: png load failed %s\n", paths[i]);
+                snprintf(paths[i], sizeof(paths[i]), "%s", job->default_path);
+            }
+        }
+        job->res.status = ST_FAILED;
+        // Fallback: show default marquee where the ROM marquee could not be decoded
+        failed = load_and_draw(failed & ~missing, paths, &tok, &job->res) | (failed & missing);
+        if (is_cancelled(&tok))
+            return;
+    }
+
+    if (failed)
+        ts_fprintf(stderr, "warning: default marquee load failed: %s\n", job->default_path); // screen remains black
+    if (job->kind == JOB_ROM && job->res.status == ST_SHOWN)
+        ts_printf("dmarquees: game marquee loaded: %s.png\n", job->rom);
+    else if (failed != mask)
+        ts_printf("dmarquees: showing default marquee: %s\n", job->default_path);
+
+    job->drawn = mask;
+    job->completed = true;
+}
+
+/* Queue worker: pops jobs in order, executes them and hands them back to the main loop through
+   job_done_fd. Jobs cancelled while still queued are passed straight through. */
+static void *job_worker(void *arg)
+{
+    JobQueue *q = arg;
+    trace_thread_name(q->name);
+    pthread_mutex_lock(&job_lock);
+    while (!worker_quit)
+    {
+        if (!q->head || q->paused)
+        {
+            pthread_cond_wait(&q->cond, &job_lock);
+            continue;
+        }
+        RenderJob *job = q->head;
+        q->head = job->next;
+        if (!q->head)
+            q->tail = NULL;
+        job->next = NULL;
+        q->current = job;
+        pthread_mutex_unlock(&job_lock);
+
+        if (!atomic_load(&job->cancelled))
+        {
+            uint64_t t0 = monotonic_us();
+            execute_job(job);
+            trace_span("render", job->kind == JOB_PREFETCH ? "prefetch" : "render job", t0, monotonic_us(),
+                       job->kind == JOB_DEFAULT ? job->default_path : job->rom);
+        }
+
+        pthread_mutex_lock(&job_lock);
+        q->current = NULL;
+        if (done_tail)
+            done_tail->next = job;
+        else
+            done_head = job;
+        done_tail = job;
+
+        uint64_t one = 1;
+        if (write(job_done_fd, &one, sizeof(one)) != sizeof(one))
+            ts_perror("write (job eventfd)");
+    }
+    pthread_mutex_unlock(&job_lock);
+    return NULL;
+}
+
+// Display jobs supersede older display jobs on a subset of their outputs; prefetches never race
+static bool supersedes(const RenderJob *newer, const RenderJob *older)
+{
+    return newer->kind != JOB_PREFETCH && older->kind != JOB_PREFETCH && (older->mask & ~newer->mask) == 0;
+}
+
+/* Queue a job: prefetches go to the background worker, display jobs to the render worker. The
+   newest display command wins: queued or in-flight jobs whose outputs are all covered by the
+   new job are cancelled, so a stale marquee can never be drawn after a newer one. */
+static void submit_job(RenderJob *job)
+{
+    JobQueue *q = job->kind == JOB_PREFETCH ? &background_q : &render_q;
+
+    pthread_mutex_lock(&job_lock);
+    for (RenderJob *j = q->head; j; j = j->next)
+    {
+        if (supersedes(job, j))
+            atomic_store(&j->cancelled, true);
+    }
+    if (q->current && supersedes(job, q->current))
+        atomic_store(&q->current->cancelled, true);
+
+    if (q->tail)
+        q->tail->next = job;
+    else
+        q->head = job;
+    q->tail = job;
+    pthread_cond_signal(&q->cond);
+    pthread_mutex_unlock(&job_lock);
+}
+
+// Create and submit a render job; the command's reply (if any) is sent when it completes
+static void submit_display_job(JobKind kind, uint32_t mask, const char *rom, const QueuedCommand *q,
+                               const CmdResult *res)
+{
+    RenderJob *job = calloc(1, sizeof(RenderJob));
+    if (!job)
+    {
+        ts_perror("calloc (render job)");
+        return;
+    }
+    job->kind = kind;
+    job->mask = mask;
+    if (rom)
+        snprintf(job->rom, sizeof(job->rom), "%s", rom);
+    default_marquee_path(job->default_path, sizeof(job->default_path));
+    atomic_init(&job->cancelled, false);
+    job->res = *res;
+    job->client_fd = q ? q->client_fd : -1;
+    if (q)
+        snprintf(job->cmd, sizeof(job->cmd), "%s", q->cmd);
+    submit_job(job);
+}
+
+// Draw the default marquee on the outputs in mask (asynchronously, on the render worker)
+static void show_default_marquee(uint32_t mask)
+{
+    CmdResult res = {.status = ST_OK, .crtc_ok = true};
+    submit_display_job(JOB_DEFAULT, mask, NULL, NULL, &res);
+}
+
+static void __attribute__((unused)) print_usage(const char *prog)
+{
+    ts_error("Usage: %s " USAGE_ARGS "\n", prog);
+}
+
+// Connector name as the kernel reports it, e.g. "HDMI-A-1"
+static void connector_name(const drmModeConnector *conn, char *buf, size_t size)
+{
+    const char *type = drmModeGetConnectorTypeName(conn->connector_type);
+    snprintf(buf, size, "%s-%u", type ? type : "Unknown", conn->connector_type_id);
+}
+
+// Pick a CRTC for the connector that is not in busy_crtcs (bitmask of res->crtcs indices)
+static uint32_t pick_crtc(int fd, const drmModeRes *res, const drmModeConnector *conn, uint32_t busy_crtcs)
+{
+    uint32_t possible = 0;
+    uint32_t current = 0;
+
+    for (int e = 0; e < conn->count_encoders; ++e)
+    {
+        drmModeEncoder *enc = drmModeGetEncoder(fd, conn->encoders[e]);
+        if (!enc)
+            continue;
+        possible |= enc->possible_crtcs;
+        if (enc->encoder_id == conn->encoder_id)
+            current = enc->crtc_id;
+        drmModeFreeEncoder(enc);
+    }
+
+    // keep the CRTC already driving this connector if nobody else has it
+    for (int c = 0; c < res->count_crtcs; ++c)
+    {
+        if (res->crtcs[c] == current && !(busy_crtcs & (1u << c)))
+            return current;
+    }
+    for (int c = 0; c < res->count_crtcs; ++c)
+    {
+        if ((possible & (1u << c)) && !(busy_crtcs & (1u << c)))
+            return res->crtcs[c];
+    }
+    // no encoder information: fall back to the first free CRTC
+    for (int c = 0; !possible && c < res->count_crtcs; ++c)
+    {
+        if (!(busy_crtcs & (1u << c)))
+            return res->crtcs[c];
+    }
+    return 0;
+}
+
+// Bitmask (res->crtcs indices) of CRTCs used by outputs other than skip
+static uint32_t busy_crtc_mask(const drmModeRes *res, const Output *skip)
+{
+    uint32_t busy = 0;
+    for (int i = 0; i < num_outputs; ++i)
+    {
+        // by index: hotplug probes a copy of the output, whose own CRTC is not busy
+        if (i == skip->index || !outputs[i].crtc_id)
+            continue;
+        for (int c = 0; c < res->count_crtcs; ++c)
+        {
+            if (res->crtcs[c] == outputs[i].crtc_id)
+                busy |= 1u << c;
+        }
+    }
+    return busy;
+}
+
+// Refresh rate of a mode in mHz (vrefresh is rounded to whole Hz, e.g. 23.976 -> 24)
+static long mode_refresh_mhz(const drmModeModeInfo *m)
+{
+    long total = (long)m->htotal * m->vtotal;
+    if (total <= 0)
+        return (long)m->vrefresh * 1000;
+    return (long)((long long)m->clock * 1000000 / total);
+}
+
+/* Index of the mode to use among the connector's w x h modes, or -1 if there is none.
+   By default the first (kernel preferred order) is kept as before; with -r the refresh policy
+   picks the lowest progressive rate ("-r min") or the one closest to the requested Hz, since
+   scanout memory reads scale linearly with refresh. */
+static int pick_mode(const drmModeConnector *conn, int w, int h)
+{
+    int best = -1;
+    for (int m = 0; m < conn->count_modes; ++m)
+    {
+        const drmModeModeInfo *mi = &conn->modes[m];
+        if ((int)mi->hdisplay != w || (int)mi->vdisplay != h)
+            continue;
+        if (best < 0)
+        {
+            best = m;
+            continue;
+        }
+        if (g_refresh_hz == 0)
+            break;
+
+        // never trade a progressive mode for an interlaced one
+        bool interlaced = mi->flags & DRM_MODE_FLAG_INTERLACE;
+        bool best_interlaced = conn->modes[best].flags & DRM_MODE_FLAG_INTERLACE;
+        if (interlaced != best_interlaced)
+        {
+            if (best_interlaced)
+                best = m;
+            continue;
+        }
+
+        long r = mode_refresh_mhz(mi);
+        long rb = mode_refresh_mhz(&conn->modes[best]);
+        if (g_refresh_hz < 0 ? r < rb : labs(r - g_refresh_hz * 1000L) < labs(rb - g_refresh_hz * 1000L))
+            best = m;
+    }
+    return best;
+}
+
+/* Find connector and mode for an output (same logic as before, optionally restricted to the
+   connector named by out->want, by name or numeric id). Fills conn_id, crtc_id, mode, name. */
+static int drm_find_connector_mode(Output *out)
+{
+    drmModeRes *res = drmModeGetResources(drm_fd);
+    if (!res)
+        return -1;
+    uint32_t busy = busy_crtc_mask(res, out);
+
+    // pass 0: preferred resolution, pass 1: fallback to the connector's first mode
+    for (int pass = 0; pass < 2; ++pass)
+    {
+        for (int i = 0; i < res->count_connectors; ++i)
+        {
+            drmModeConnector *conn = drmModeGetConnector(drm_fd, res->connectors[i]);
+            if (!conn)
+                continue;
+            if (conn->connection != DRM_MODE_CONNECTED || conn->count_modes == 0)
+            {
+                drmModeFreeConnector(conn);
+                continue;
+            }
+
+            char name[32];
+            connector_name(conn, name, sizeof(name));
+            if (out->want && strcmp(out->want, name) != 0 && strtoul(out->want, NULL, 10) != conn->connector_id)
+            {
+                drmModeFreeConnector(conn);
+                continue;
+            }
+
+            int mode = pass == 0 ? pick_mode(conn, PREFERRED_W, PREFERRED_H)
+                                 : pick_mode(conn, conn->modes[0].hdisplay, conn->modes[0].vdisplay);
+
+            uint32_t chosen_crtc = mode >= 0 ? pick_crtc(drm_fd, res, conn, busy) : 0;
+            if (chosen_crtc)
+            {
+                out->conn_id = conn->connector_id;
+                out->crtc_id = chosen_crtc;
+                for (int c = 0; c < res->count_crtcs; ++c)
+                    if (res->crtcs[c] == chosen_crtc)
+                        out->pipe = c;
+                out->mode = conn->modes[mode];
+                snprintf(out->name, sizeof(out->name), "%s", name);
+                drmModeFreeConnector(conn);
+                drmModeFreeResources(res);
+                return 0;
+            }
+            drmModeFreeConnector(conn);
+        }
+    }
+    drmModeFreeResources(res);
+    return -1;
+}
+
+static uint32_t fourcc_for(PixelFormat f)
+{
+    switch (f)
+    {
+    case PIX_XBGR8888: return DRM_FORMAT_XBGR8888;
+    case PIX_ABGR8888: return DRM_FORMAT_ABGR8888;
+    case PIX_RGB565:   return DRM_FORMAT_RGB565;
+    case PIX_XRGB8888:
+    default:           return DRM_FORMAT_XRGB8888;
+    }
+}
+
+// Value of a named property of a KMS object, or def if the object has no such property
+static uint64_t get_prop_value(int fd, uint32_t obj_id, uint32_t obj_type, const char *name, uint64_t def)
+{
+    drmModeObjectProperties *props = drmModeObjectGetProperties(fd, obj_id, obj_type);
+    if (!props)
+        return def;
+    uint64_t value = def;
+    for (uint32_t i = 0; i < props->count_props; ++i)
+    {
+        drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
+        if (!prop)
+            continue;
+        bool match = strcmp(prop->name, name) == 0;
+        drmModeFreeProperty(prop);
+        if (match)
+        {
+            value = props->prop_values[i];
+            break;
+        }
+    }
+    drmModeFreeObjectProperties(props);
+    return value;
+}
+
+// True if the IN_FORMATS blob lists fourcc as scanout-capable with a linear (dumb buffer) layout
+static bool in_formats_has_linear(const drmModePropertyBlobRes *blob, uint32_t fourcc)
+{
+    const struct drm_format_modifier_blob *hdr = blob->data;
+    const uint32_t *formats = (const uint32_t *)((const char *)hdr + hdr->formats_offset);
+    const struct drm_format_modifier *mods =
+        (const struct drm_format_modifier *)((const char *)hdr + hdr->modifiers_offset);
+
+    for (uint32_t f = 0; f < hdr->count_formats; ++f)
+    {
+        if (formats[f] != fourcc)
+            continue;
+        if (hdr->count_modifiers == 0)
+            return true; // no modifier information: linear is implied
+        for (uint32_t m = 0; m < hdr->count_modifiers; ++m)
+        {
+            if (mods[m].modifier == DRM_FORMAT_MOD_LINEAR && f >= mods[m].offset && f < mods[m].offset + 64 &&
+                (mods[m].formats & (1ull << (f - mods[m].offset))))
+                return true;
+        }
+    }
+    return false;
+}
+
+/* Pick the framebuffer format for the primary plane feeding crtc_id: RGB565 first when a 16 bpp
+   framebuffer was requested (-b 16), then a layout that matches the decoded RGBA bytes (XBGR8888,
+   ABGR8888) so rows need no channel shuffling, else the universally supported XRGB8888.
+   Uses the plane's IN_FORMATS blob when present. */
+static PixelFormat choose_fb_format(int fd, uint32_t crtc_id)
+{
+    static const PixelFormat prefs[] = {PIX_RGB565, PIX_XBGR8888, PIX_ABGR8888};
+    PixelFormat chosen = PIX_XRGB8888;
+
+    drmModeRes *res = drmModeGetResources(fd);
+    drmModePlaneRes *planes = drmModeGetPlaneResources(fd);
+    if (!res || !planes)
+        goto out;
+
+    int crtc_index = -1;
+    for (int c = 0; c < res->count_crtcs; ++c)
+    {
+        if (res->crtcs[c] == crtc_id)
+            crtc_index = c;
+    }
+
+    for (uint32_t p = 0; crtc_index >= 0 && p < planes->count_planes; ++p)
+    {
+        drmModePlane *plane = drmModeGetPlane(fd, planes->planes[p]);
+        if (!plane)
+            continue;
+        if (!(plane->possible_crtcs & (1u << crtc_index)) ||
+            get_prop_value(fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "type", DRM_PLANE_TYPE_OVERLAY) !=
+                DRM_PLANE_TYPE_PRIMARY)
+        {
+            drmModeFreePlane(plane);
+            continue;
+        }
+
+        uint64_t blob_id = get_prop_value(fd, plane->plane_id, DRM_MODE_OBJECT_PLANE, "IN_FORMATS", 0);
+        drmModePropertyBlobRes *blob = blob_id ? drmModeGetPropertyBlob(fd, (uint32_t)blob_id) : NULL;
+        for (size_t i = g_fb_bpp == 16 ? 0 : 1; i < sizeof(prefs) / sizeof(prefs[0]) && chosen == PIX_XRGB8888; ++i)
+        {
+            uint32_t fourcc = fourcc_for(prefs[i]);
+            bool supported = false;
+            if (blob)
+                supported = in_formats_has_linear(blob, fourcc);
+            else
+            {
+                for (uint32_t f = 0; f < plane->count_formats; ++f)
+                    supported |= plane->formats[f] == fourcc;
+            }
+            if (supported)
+                chosen = prefs[i];
+        }
+        if (blob)
+            drmModeFreePropertyBlob(blob);
+        drmModeFreePlane(plane);
+        break;
+    }
+
+out:
+    if (planes)
+        drmModeFreePlaneResources(planes);
+    if (res)
+        drmModeFreeResources(res);
+    return chosen;
+}
+
+/* Create and map a dumb buffer sized to the output's mode, add FB, keep mapping pointer in fb_map */
+static int drm_create_fb(Output *o)
+{
+    uint32_t width = o->mode.hdisplay;
+    uint32_t height = o->mode.vdisplay;
+    o->format = choose_fb_format(drm_fd, o->crtc_id);
+    uint32_t bpp = pixel_format_bpp(o->format);
+
+    struct drm_mode_create_dumb creq = {0};
+    creq.width = width;
+    creq.height = height;
+    creq.bpp = bpp;
+    if (ioctl(drm_fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0)
+    {
+        ts_perror("DRM_IOCTL_MODE_CREATE_DUMB");
+        return -1;
+    }
+    o->dumb_handle = creq.handle;
+    o->stride = creq.pitch;
+    o->bo_size = creq.size;
+    // map
+    struct drm_mode_map_dumb mreq = {0};
+    mreq.handle = o->dumb_handle;
+    if (ioctl(drm_fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) < 0)
+    {
+        ts_perror("DRM_IOCTL_MODE_MAP_DUMB");
+        return -1;
+    }
+    o->fb_map = mmap(0, o->bo_size, PROT_READ | PROT_WRITE, MAP_SHARED, drm_fd, mreq.offset);
+    if (o->fb_map == MAP_FAILED)
+    {
+        ts_perror("mmap");
+        o->fb_map = NULL;
+        return -1;
+    }
+    // create FB in the negotiated format, falling back to legacy AddFB (XRGB8888 or RGB565)
+    uint32_t handles[4] = {o->dumb_handle};
+    uint32_t pitches[4] = {o->stride};
+    uint32_t offsets[4] = {0};
+    if (o->format != PIX_XRGB8888 &&
+        drmModeAddFB2(drm_fd, width, height, fourcc_for(o->format), handles, pitches, offsets, &o->fb_id, 0))
+    {
+        ts_perror("drmModeAddFB2 (falling back to legacy AddFB)");
+        if (o->format != PIX_RGB565)
+            o->format = PIX_XRGB8888;
+    }
+    if (!o->fb_id && drmModeAddFB(drm_fd, width, height, bpp == 16 ? 16 : 24, bpp, o->stride, o->dumb_handle, &o->fb_id))
+    {
+        ts_perror("drmModeAddFB");
+        munmap(o->fb_map, o->bo_size);
+        o->fb_map = NULL;
+        return -1;
+    }
+    uint32_t fourcc = fourcc_for(o->format);
+    ts_printf("dmarquees: %s framebuffer format %.4s\n", o->name, (const char *)&fourcc);
+    memset(o->fb_map, 0x00, o->bo_size); // Clear framebuffer (black)
+    return 0;
+}
+
+static void drm_destroy_fb(Output *o)
+{
+    if (o->fb_id)
+    {
+        drmModeRmFB(drm_fd, o->fb_id);
+        o->fb_id = 0;
+    }
+    if (o->fb_map)
+    {
+        munmap(o->fb_map, o->bo_size);
+        o->fb_map = NULL;
+    }
+    if (o->dumb_handle)
+    {
+        struct drm_mode_destroy_dumb dreq = {.handle = o->dumb_handle};
+        ioctl(drm_fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+        o->dumb_handle = 0;
+    }
+}
+
+static int drm_open(void)
+{
+    drm_fd = open(g_device_path, O_RDWR | O_CLOEXEC);
+    if (drm_fd < 0)
+        return -1;
+
+    // expose primary planes so the framebuffer format can be negotiated
+    if (drmSetClientCap(drm_fd, DRM_CLIENT_CAP_UNIVERSAL_PLANES, 1) != 0)
+        ts_perror("drmSetClientCap UNIVERSAL_PLANES (ignored)");
+    return 0;
+}
+
+static void drm_close(void)
+{
+    if (drm_fd >= 0)
+    {
+        drmDropMaster(drm_fd);
+        close(drm_fd);
+        drm_fd = -1;
+    }
+}
+
+static bool drm_acquire(void)
+{
+    return drmSetMaster(drm_fd) == 0;
+}
+
+static bool drm_release(void)
+{
+    return drmDropMaster(drm_fd) == 0;
+}
+
+static int drm_set_crtc(Output *o)
+{
+    return drmModeSetCrtc(drm_fd, o->crtc_id, o->fb_id, 0, 0, &o->conn_id, 1, &o->mode);
+}
+
+/* One-shot vblank event on o's CRTC (pipes above 0 are encoded in the high-CRTC bits); it
+   is read from drm_fd by drm_handle_events */
+static int drm_request_vblank(Output *o, void *data)
+{
+    drmVBlank vbl;
+    memset(&vbl, 0, sizeof(vbl));
+    vbl.request.type = (drmVBlankSeqType)(DRM_VBLANK_RELATIVE | DRM_VBLANK_EVENT |
+                                          ((o->pipe << DRM_VBLANK_HIGH_CRTC_SHIFT) & DRM_VBLANK_HIGH_CRTC_MASK));
+    vbl.request.sequence = 1;
+    vbl.request.signal = (unsigned long)data;
+    return drmWaitVBlank(drm_fd, &vbl);
+}
+
+// Event timestamps are CLOCK_MONOTONIC, the clock of monotonic_us()
+static void drm_vblank_handler(int fd, unsigned int sequence, unsigned int tv_sec, unsigned int tv_usec,
+                               void *user_data)
+{
+    (void)fd;
+    (void)sequence;
+    display_vblank(user_data, (uint64_t)tv_sec * 1000000u + tv_usec);
+}
+
+static int drm_event_fd(void)
+{
+    return drm_fd;
+}
+
+static void drm_handle_events(void)
+{
+    drmEventContext ctx = {.version = 2, .vblank_handler = drm_vblank_handler};
+    if (drmHandleEvent(drm_fd, &ctx) != 0)
+        ts_perror("drmHandleEvent");
+}
+
+static const DisplayBackend drm_backend = {
+    .name = "drm",
+    .open = drm_open,
+    .close = drm_close,
+    .find_connector_mode = drm_find_connector_mode,
+    .create_fb = drm_create_fb,
+    .destroy_fb = drm_destroy_fb,
+    .acquire = drm_acquire,
+    .release = drm_release,
+    .set_crtc = drm_set_crtc,
+    .request_vblank = drm_request_vblank,
+    .event_fd = drm_event_fd,
+    .handle_events = drm_handle_events,
+};
+
+// Create o's framebuffer through the display backend, counting it in MEM_FRAMEBUFFERS
+static int create_output_fb(Output *o)
+{
+    if (display->create_fb(o) != 0)
+        return -1;
+    stats_mem_add(MEM_FRAMEBUFFERS, (int64_t)o->bo_size);
+    return 0;
+}
+
+static void destroy_output_fb(Output *o)
+{
+    if (o->fb_map)
+        stats_mem_add(MEM_FRAMEBUFFERS, -(int64_t)o->bo_size);
+    display->destroy_fb(o);
+}
+
+// Build the output table from the -o specs (CONNECTOR[=IMAGEDIR]); one automatic output if none
+static void setup_outputs(void)
+{
+    num_outputs = g_num_output_specs > 0 ? g_num_output_specs : 1;
+    for (int i = 0; i < num_outputs; ++i)
+    {
+        Output *o = &outputs[i];
+        o->index = i;
+        o->image_dir = IMAGE_DIR;
+        if (i >= g_num_output_specs)
+            continue;
+
+        static char specs[MAX_OUTPUTS][512];
+        snprintf(specs[i], sizeof(specs[i]), "%s", g_output_specs[i]);
+        char *eq = strchr(specs[i], '=');
+        if (eq)
+        {
+            *eq = '\0';
+            if (eq[1])
+                o->image_dir = eq + 1;
+        }
+        o->want = specs[i];
+    }
+}
+
+static int initialize(void)
+{
+    // ensure FIFO exists
+    if (mkfifo(DMQ_FIFO, 0666) < 0)
+    {
+        if (errno != EEXIST)
+        {
+            ts_perror("mkfifo");
+            return 1;
+        }
+    }
+    chmod(DMQ_FIFO, 0666); // allow any user to write commands
+
+    // open DRM device (or the headless display)
+    if (display->open() != 0)
+    {
+        ts_perror("open drm");
+        return 1;
+    }
+
+    // attempt to become DRM master (recommended for daemon)
+    bool is_master = display->acquire();
+    if (!is_master)
+    {
+        ts_perror("drmSetMaster (ignored)");
+        // continue: we may still be able to set the CRTC depending on environment
+    }
+
+    // locate connector & mode and create a persistent dumb framebuffer for each output
+    setup_outputs();
+    int found = 0;
+    for (int i = 0; i < num_outputs; ++i)
+    {
+        Output *o = &outputs[i];
+        if (display->find_connector_mode(o) != 0)
+        {
+            ts_fprintf(stderr, "warning: output %d (%s) not connected\n", i, o->want ? o->want : "auto");
+            continue;
+        }
+
+        ts_printf("dmarquees: Output %d: connector %u (%s) mode %dx%d@%.2f crtc %u images %s\n", i, o->conn_id,
+                  o->name, o->mode.hdisplay, o->mode.vdisplay, mode_refresh_mhz(&o->mode) / 1000.0, o->crtc_id,
+                  o->image_dir);
+
+        if (create_output_fb(o) != 0)
+        {
+            ts_error("error: Failed to create dumb FB\n");
+            display->close();
+            return 1;
+        }
+        found++;
+    }
+
+    if (found == 0)
+    {
+        ts_error("error: Failed to find connected output\n");
+        display->close();
+        return 1;
+    }
+
+    // Release DRM master so other apps (like MAME) can take control
+    if (is_master)
+    {
+        if (!display->release())
+            ts_fprintf(stderr, "warning: drmDropMaster(1) failed (%s)\n", strerror(errno));
+        else
+            ts_printf("dmarquees: DRM master dropped - MAME can safely start.\n");
+    }
+
+    // draw default marquee (RetroPie NA frontend); the render worker is not running yet
+    RenderJob job = {.kind = JOB_DEFAULT, .mask = ALL_OUTPUTS, .client_fd = -1};
+    atomic_init(&job.cancelled, false);
+    default_marquee_path(job.default_path, sizeof(job.default_path));
+    execute_job(&job);
+    try_reset_crtc(job.drawn);
+
+    return 0;
+}
+
+/* Subscribe to kernel uevents (DRM hotplug). Failure is not fatal: the daemon
+   simply falls back to manual RESET after a monitor is replugged. */
+static int open_uevent_socket(void)
+{
+    int fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_CLOEXEC | SOCK_NONBLOCK, NETLINK_KOBJECT_UEVENT);
+    if (fd < 0)
+    {
+        ts_perror("socket (uevent)");
+        return -1;
+    }
+
+    struct sockaddr_nl addr = {0};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_pid = 0;    // let the kernel assign a port id
+    addr.nl_groups = 1; // kernel uevent multicast group
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+        ts_perror("bind (uevent)");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* Re-probe the connectors after a hotplug event. If an output's connector, CRTC or mode
+   changed its framebuffer is re-created at the new size; the current marquee is then redrawn
+   from the already decoded image and the CRTCs are set again. */
+static void handle_hotplug(void)
+{
+    uint32_t redraw = 0;
+    uint32_t reset = 0;
+
+    pthread_mutex_lock(&outputs_lock);   // the render worker may be blitting
+
+    for (int i = 0; i < num_outputs; ++i)
+    {
+        Output *o = &outputs[i];
+        Output probe = *o;
+
+        if (display->find_connector_mode(&probe) != 0)
+        {
+            ts_printf("dmarquees: hotplug - output %d not connected, keeping current framebuffer\n", i);
+            continue;
+        }
+        reset |= 1u << i;
+
+        bool changed = probe.conn_id != o->conn_id || probe.crtc_id != o->crtc_id ||
+                       memcmp(&probe.mode, &o->mode, sizeof(probe.mode)) != 0 || !o->fb_map;
+        if (!changed)
+        {
+            ts_printf("dmarquees: hotplug - output %d unchanged\n", i);
+            continue;
+        }
+
+        ts_printf("dmarquees: hotplug - output %d connector %u (%s) mode %dx%d@%u crtc %u\n", i, probe.conn_id,
+                  probe.name, probe.mode.hdisplay, probe.mode.vdisplay, probe.mode.vrefresh, probe.crtc_id);
+
+        destroy_output_fb(o);
+        o->conn_id = probe.conn_id;
+        o->crtc_id = probe.crtc_id;
+        o->pipe = probe.pipe;
+        o->mode = probe.mode;
+        memcpy(o->name, probe.name, sizeof(o->name));
+        if (create_output_fb(o) != 0)
+        {
+            ts_error("error: hotplug - failed to re-create dumb FB\n");
+            continue;
+        }
+        redraw |= 1u << i;
+    }
+
+    // an output that had nothing decoded yet (absent at startup) gets the default marquee
+    uint32_t fresh = 0;
+    for (int i = 0; i < num_outputs; ++i)
+    {
+        if ((redraw & (1u << i)) && !outputs[i].image)
+            fresh |= 1u << i;
+    }
+
+    draw_outputs(redraw & ~fresh, NULL);
+    pthread_mutex_unlock(&outputs_lock);
+
+    if (reset & ~fresh)
+        try_reset_crtc(reset & ~fresh);
+    if (fresh)
+        show_default_marquee(fresh);
+}
+
+/* Process one uevent datagram. Synthetic events (HOTPLUG command) use the same path. */
+static void process_uevent(const char *msg, size_t len)
+{
+    if (is_drm_hotplug_uevent(msg, len, g_device_path + strlen("/dev/")))
+        handle_hotplug();
+}
+
+// Drain all pending uevents from the netlink socket (event loop handler)
+static void on_uevent(int fd, uint32_t events, void *ctx)
+{
+    (void)events;
+    (void)ctx;
+    char msg[4096];
+    ssize_t n;
+    while ((n = recv(fd, msg, sizeof(msg), 0)) > 0)
+        process_uevent(msg, (size_t)n);
+}
+
+// Build a synthetic DRM hotplug uevent for our device and feed it through the uevent path
+static void inject_synthetic_uevent(void)
+{
+    char msg[256];
+    const char *devname = g_device_path + strlen("/dev/");
+    int len = snprintf(msg, sizeof(msg),
+                       "change@/devices/synthetic/drm/%s%c"
+                       "ACTION=change%c"
+                       "DEVNAME=%s%c"
+                       "SUBSYSTEM=drm%c"
+                       "HOTPLUG=1",
+                       strrchr(devname, '/') + 1, 0, 0, devname, 0, 0);
+    ts_printf("dmarquees: injecting synthetic hotplug uevent\n");
+    process_uevent(msg, (size_t)len + 1);
+}
+
+/* Act on one queued command; the outcome and stage timings are recorded in res. Display commands
+   are handed to the render worker and return true: their reply is sent when the job completes. */
+static bool dispatch_command(const QueuedCommand *q, CmdResult *res)
+{
+    char cmd_buf_copy[sizeof(q->cmd)];
+    memcpy(cmd_buf_copy, q->cmd, sizeof(cmd_buf_copy));
+    cmd_buf_copy[sizeof(cmd_buf_copy) - 1] = '\0';
+    char *cmd_str = cmd_buf_copy;
+    ts_printf("dmarquees: command received: '%s'\n", cmd_str);
+
+    res->status = ST_OK;
+    res->crtc_ok = true;
+    res->start_us = monotonic_us();
+
+    // optional "<n>:" output prefix
+    int target = -1;
+    cmd_str = split_output_target(cmd_str, &target);
+    if (target >= num_outputs)
+    {
+        ts_fprintf(stderr, "warning: no output %d, command ignored\n", target);
+        res->status = ST_BAD_OUTPUT;
+        return false;
+    }
+    uint32_t mask = target >= 0 ? 1u << target : ALL_OUTPUTS;
+
+    CommandType command = toCommandType(cmd_str);
+    if (command >= 0 && command < CMD_TYPE_COUNT)
+        command_counts[command]++;
+
+    switch (command)
+    {
+    case CMD_RA:
+        g_frontend_mode = eRA;
+        ts_printf("dmarquees: frontend mode changed to RA\n");
+        submit_display_job(JOB_DEFAULT, mask, NULL, q, res);
+        return true;
+
+    case CMD_SA:
+        g_frontend_mode = eSA;
+        ts_printf("dmarquees: frontend mode changed to SA\n");
+        submit_display_job(JOB_DEFAULT, mask, NULL, q, res);
+        return true;
+
+    case CMD_NA:
+        g_frontend_mode = eNA;
+        ts_printf("dmarquees: frontend mode changed to NA\n");
+        submit_display_job(JOB_DEFAULT, mask, NULL, q, res);
+        return true;
+
+    case CMD_EXIT:
+        running = false;
+        break;
+
+    case CMD_CLEAR:
+        submit_display_job(JOB_DEFAULT, mask, NULL, q, res);
+        return true;
+
+    case CMD_RESET:
+    {
+        uint64_t t0 = monotonic_us();
+        res->crtc_ok = try_reset_crtc(mask);
+        res->crtc_us = monotonic_us() - t0;
+        break;
+    }
+
+    case CMD_HOTPLUG:
+        inject_synthetic_uevent();
+        break;
+
+    case CMD_STATS:
+    {
+        static char stats_text[STATS_TEXT_MAX];
+        stats_format(stats_text, sizeof(stats_text));
+        if (q->client_fd >= 0)
+            res->body = stats_text; // sent after the status line
+        else
+            ts_printf("dmarquees: stats\n%s\n", stats_text);
+        break;
+    }
+
+    case CMD_MEM:
+    {
+        static char mem_text[STATS_TEXT_MAX];
+        int len = stats_format_mem(mem_text, sizeof(mem_text), g_mem_budget);
+        int entries;
+        uint64_t bytes = cache_bytes(&entries);
+        snprintf(mem_text + len, sizeof(mem_text) - len, "\ncache entries=%d bytes=%llu", entries,
+                 (unsigned long long)bytes);
+        if (q->client_fd >= 0)
+            res->body = mem_text;
+        else
+            ts_printf("dmarquees: memory\n%s\n", mem_text);
+        break;
+    }
+
+    case CMD_PREFETCH:
+        // decode ahead of the ROM command (e.g. while the frontend scrolls), reply when cached
+        submit_display_job(JOB_PREFETCH, mask, cmd_str + strlen("PREFETCH "), q, res);
+        return true;
+
+    case CMD_ROM:
+    {
+        // If we reach here, it's either eROM or an unknown command - treat as ROM shortname
+        uint64_t t0 = monotonic_us();
+        bool multiscreen = game_has_multiple_screens(cmd_str);
+        stats_record(STAGE_MULTISCREEN, monotonic_us() - t0);
+        trace_span("command", "multiscreen check", t0, monotonic_us(), cmd_str);
+        if (multiscreen)
+        {
+            ts_printf("dmarquees: Skipping multi-screen game: %s\n", cmd_str);
+            res->status = ST_MULTISCREEN;
+            break;
+        }
+
+        // otherwise treat as rom shortname (falls back to the default marquee if missing)
+        submit_display_job(JOB_ROM, mask, cmd_str, q, res);
+        return true;
+    }
 
-static volatile bool running = true;
-static int drm_fd = -1;
-static uint32_t conn_id = 0;
-static uint32_t crtc_id = 0;
-static drmModeModeInfo chosen_mode;
+    default:    // never happens
+        break;
+    }
+    return false;
+}
 
-/* DRM dumb buffer state */
-static uint32_t dumb_handle = 0;
-static uint32_t fb_id = 0;
-static uint32_t stride = 0;
-static uint64_t bo_size = 0;
-static void* fb_map = NULL;
+/* -T: every received command is appended to the trace file as "<us> <fifo|sock|ring> <command>",
+   times relative to the first command, for tools/dmqreplay */
+static void trace_command(const char *source, const char *cmd_str, uint64_t recv_us)
+{
+    if (!trace_fp)
+        return;
+    if (!trace_t0)
+        trace_t0 = recv_us;
+    fprintf(trace_fp, "%llu %s %s\n", (unsigned long long)(recv_us - trace_t0), source, cmd_str);
+}
 
-FrontendMode g_frontend_mode = eNA;
-static time_t g_ra_init_hold = 0;
-static uint8_t* image = NULL;
+static void open_trace(void)
+{
+    trace_fp = fopen(g_trace_file, "w");
+    if (!trace_fp)
+    {
+        ts_perror(g_trace_file);
+        return;
+    }
+    setvbuf(trace_fp, NULL, _IOLBF, 0); // a crash must not lose the session
+    fprintf(trace_fp, "%s\n", TRACE_HEADER);
+    ts_printf("dmarquees: recording commands to %s\n", g_trace_file);
+}
 
-// Try to reset CRTC by becoming master, setting CRTC, then dropping master
-// Returns true if drmModeSetCrtc succeeded
-static bool try_reset_crtc(void)
+// Queue a trimmed command for the next dispatch round. Returns false if the queue is full.
+static bool enqueue_command(const char *source, const char *cmd_str, int client_fd, uint64_t recv_us)
 {
-    ts_printf("dmarquees: trying CRTC reset\n");
+    if (cmd_queue_len == CMD_BATCH_MAX)
+        return false;
+    trace_command(source, cmd_str, recv_us);
+    QueuedCommand *q = &cmd_queue[cmd_queue_len++];
+    snprintf(q->cmd, sizeof(q->cmd), "%s", cmd_str);
+    q->client_fd = client_fd;
+    q->recv_us = recv_us;
+    return true;
+}
 
-    bool crtc_success = false;
-    bool got_master = drmSetMaster(drm_fd) == 0;
-    if (!got_master)
-        ts_perror("drmSetMaster (try_reset_crtc)");
-    else
-        ts_printf("dmarquees: master set\n");
+// Move the complete newline-terminated commands out of cmd_buf into the queue; a partial line stays
+static void extract_fifo_lines(void)
+{
+    uint64_t now = monotonic_us();
+    size_t start = 0;
 
-    if (drmModeSetCrtc(drm_fd, crtc_id, fb_id, 0, 0, &conn_id, 1, &chosen_mode) != 0)
-        ts_perror("drmModeSetCrtc (try_reset_crtc)");
-    else
+    for (size_t i = 0; i < cmd_len && cmd_queue_len < CMD_BATCH_MAX; ++i)
     {
-        ts_printf("dmarquees: crtc reset success!\n");
-        crtc_success = true;
+        if (cmd_buf[i] != '\n')
+            continue;
+        cmd_buf[i] = '\0';
+        // trim() terminates at len - 1, so hand it the line including its terminator
+        char *cmd_str = trim(cmd_buf + start, i - start + 1);
+        if (cmd_str)
+            enqueue_command("fifo", cmd_str, -1, now);
+        start = i + 1;
     }
 
-    if (got_master)
+    cmd_len -= start;
+    memmove(cmd_buf, cmd_buf + start, cmd_len);
+    // a full buffer of complete lines (the queue filled up first) waits for the next round
+    if (cmd_len == sizeof(cmd_buf) && !memchr(cmd_buf, '\n', cmd_len))
     {
-        if (drmDropMaster(drm_fd) != 0)
-            ts_perror("drmDropMaster (try_reset_crtc)");
-        else
-            ts_printf("dmarquees: master dropped\n");
+        ts_fprintf(stderr, "warning: command line too long, discarded\n");
+        cmd_len = 0;
     }
-    return crtc_success;
 }
 
-// Pick default marquee name based on frontend mode
-static const char *default_marquee_name_for(FrontendMode m)
+// Send the status line and latency breakdown of a command to a control socket client
+static void send_reply(int client_fd, const char *cmd_str, const CmdResult *res)
 {
-    switch (m)
+    char reply[CMD_MAX_LEN + 192 + STATS_TEXT_MAX];
+    uint64_t now = monotonic_us();
+    int len = snprintf(reply, sizeof(reply),
+                       "%s %s total_us=%llu queue_us=%llu stat_us=%llu decode_us=%llu blit_us=%llu crtc_us=%llu crtc=%s%s%s",
+                       fromCmdStatus(res->status), cmd_str, (unsigned long long)(now - res->recv_us),
+                       (unsigned long long)(res->start_us - res->recv_us), (unsigned long long)res->stat_us,
+                       (unsigned long long)res->decode_us, (unsigned long long)res->blit_us,
+                       (unsigned long long)res->crtc_us, res->crtc_ok ? "ok" : "pending", res->body ? "\n" : "",
+                       res->body ? res->body : "");
+    if (len >= (int)sizeof(reply))
+        len = sizeof(reply) - 1;
+    if (send(client_fd, reply, (size_t)len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+        ts_perror("send (control socket reply)");
+}
+
+// Move commands posted to the shared-memory ring into the queue
+static void drain_ring(void)
+{
+    if (!cmd_ring)
+        return;
+    dmq_ring_end_wait(cmd_ring); // awake: producers can skip the eventfd kick
+
+    char cmd[DMQ_RING_CMD_LEN];
+    uint64_t now = monotonic_us();
+    while (cmd_queue_len < CMD_BATCH_MAX && dmq_ring_pop(cmd_ring, cmd))
     {
-    case eSA: return DEF_SA_MARQUEE_NAME;
-    case eRA: return DEF_RA_MARQUEE_NAME;
-    case eNA:
-    default:  return DEF_MARQUEE_NAME;
+        char *cmd_str = trim(cmd, sizeof(cmd));
+        if (cmd_str)
+            enqueue_command("ring", cmd_str, -1, now);
     }
 }
 
-// Draw the default marquee. Clears screen to black first.
-static void show_default_marquee(void)
+/* Dispatch round, run after every batch of events: coalesce the queued commands so only the
+   newest display command per output is rendered, run them in order and answer socket clients. */
+static void run_command_queue(void)
 {
-    if (!fb_map)
-        return;
+    while (running)
+    {
+        extract_fifo_lines();
+        drain_ring();
+        if (cmd_queue_len == 0)
+            break;
 
-    const char *name = default_marquee_name_for(g_frontend_mode);
-    char imgpath[512];
-    snprintf(imgpath, sizeof(imgpath), "%s/%s.png", DEF_MARQUEE_DIR, name);
+        char *batch[CMD_BATCH_MAX];
+        bool superseded[CMD_BATCH_MAX];
+        int n = cmd_queue_len;
+        for (int i = 0; i < n; ++i)
+            batch[i] = cmd_queue[i].cmd;
 
-    int fb_w = chosen_mode.hdisplay;
-    int fb_h = chosen_mode.vdisplay;
+        int dropped = coalesce_commands(batch, n, superseded);
+        if (dropped)
+            ts_printf("dmarquees: coalesced %d superseded display command(s)\n", dropped);
 
-    // Clear entire screen to black
-    memset(fb_map, 0x00, bo_size);
+        for (int i = 0; i < n; ++i)
+        {
+            QueuedCommand *q = &cmd_queue[i];
+            CmdResult res = {.status = ST_SUPERSEDED, .crtc_ok = true, .recv_us = q->recv_us, .start_us = q->recv_us};
+
+            bool deferred = false;
+            if (!superseded[i] && running)
+                deferred = dispatch_command(q, &res);
+            if (!deferred)
+                trace_async("command", q->cmd, ++trace_cmd_id, q->recv_us, monotonic_us(), fromCmdStatus(res.status));
+            if (!deferred && q->client_fd >= 0)
+                send_reply(q->client_fd, q->cmd, &res);
+        }
+        cmd_queue_len = 0;
+    }
+}
 
-    int iw = 0, ih = 0;
-    if (image)
-        free(image);
-    image = load_png_rgba(imgpath, &iw, &ih);
-    if (!image)
+/* Render jobs finished (event loop handler): set the CRTC for what was drawn and answer the
+   clients. A job cancelled by a newer one is answered SUPERSEDED. */
+static void on_jobs_done(int fd, uint32_t events, void *ctx)
+{
+    (void)events;
+    (void)ctx;
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        ts_perror("read (job eventfd)");
+
+    pthread_mutex_lock(&job_lock);
+    RenderJob *job = done_head;
+    done_head = done_tail = NULL;
+    pthread_mutex_unlock(&job_lock);
+
+    while (job)
     {
-        ts_fprintf(stderr, "warning: default marquee load failed: %s\n", imgpath);
-        return; // screen remains black
+        RenderJob *next = job->next;
+        if (!job->completed)
+            job->res.status = ST_SUPERSEDED;
+        else if (job->drawn)
+        {
+            uint64_t t0 = monotonic_us();
+            job->res.crtc_ok = try_reset_crtc(job->drawn);
+            job->res.crtc_us += monotonic_us() - t0;
+            if (job->res.crtc_ok)
+                request_scanout(job->drawn, job->res.recv_us);
+        }
+        if (job->cmd[0])
+            trace_async("command", job->cmd, ++trace_cmd_id, job->res.recv_us, monotonic_us(),
+                        fromCmdStatus(job->res.status));
+        if (job->client_fd >= 0)
+            send_reply(job->client_fd, job->cmd, &job->res);
+        free(job);
+        job = next;
     }
+}
 
-    ts_printf("dmarquees: showing default marquee: %s\n", imgpath);
+/* Start the render and background workers and hook their completion eventfd into the event loop.
+   Both are created after the signals are blocked, so they inherit the mask. The render worker
+   inherits the main thread's policy (SCHED_FIFO with -R); the background worker runs at
+   SCHED_IDLE, only getting CPU time no emulator thread wants. Its CPU affinity is inherited,
+   so with -R PRIO@CPU it stays on the daemon's core, away from the emulator's. */
+static int start_workers(void)
+{
+    job_done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (job_done_fd < 0 || evloop_add(job_done_fd, EPOLLIN, on_jobs_done, NULL) != 0)
+    {
+        ts_perror("eventfd (workers)");
+        return -1;
+    }
+    if (pthread_create(&render_q.tid, NULL, job_worker, &render_q) != 0)
+    {
+        ts_error("error: failed to start render worker\n");
+        return -1;
+    }
+    render_q.started = true;
+
+    pthread_attr_t attr;
+    struct sched_param sp = {.sched_priority = 0};
+    pthread_attr_init(&attr);
+    pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+    pthread_attr_setschedpolicy(&attr, SCHED_IDLE);
+    pthread_attr_setschedparam(&attr, &sp);
+    background_q.paused = reacquire_pending != 0;
+    if (pthread_create(&background_q.tid, &attr, job_worker, &background_q) == 0 ||
+        pthread_create(&background_q.tid, NULL, job_worker, &background_q) == 0)
+        background_q.started = true;
+    else
+        ts_fprintf(stderr, "warning: failed to start background worker, PREFETCH will queue\n");
+    pthread_attr_destroy(&attr);
+    return 0;
+}
 
-    scale_and_blit_to_xrgb(image, iw, ih, (uint32_t*)fb_map, fb_w, fb_h, stride / 4, 0);
-    try_reset_crtc();
+static void free_job_list(struct RenderJob *job)
+{
+    while (job)
+    {
+        RenderJob *next = job->next;
+        free(job);
+        job = next;
+    }
 }
 
-static void __attribute__((unused)) print_usage(const char *prog)
+// Cancel all jobs, join the workers and free whatever is left
+static void stop_workers(void)
 {
-    ts_fprintf(stderr, "Usage: %s [-f SA|RA|NA]\n", prog);
+    JobQueue *queues[] = {&render_q, &background_q};
+
+    pthread_mutex_lock(&job_lock);
+    worker_quit = true;
+    for (int i = 0; i < 2; ++i)
+    {
+        for (RenderJob *j = queues[i]->head; j; j = j->next)
+            atomic_store(&j->cancelled, true);
+        if (queues[i]->current)
+            atomic_store(&queues[i]->current->cancelled, true);
+        pthread_cond_signal(&queues[i]->cond);
+    }
+    pthread_mutex_unlock(&job_lock);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        if (queues[i]->started)
+            pthread_join(queues[i]->tid, NULL);
+        free_job_list(queues[i]->head);
+        queues[i]->head = queues[i]->tail = NULL;
+    }
+    free_job_list(done_head);
+    done_head = done_tail = NULL;
+    if (job_done_fd >= 0)
+        close(job_done_fd);
 }
 
-static void sigint_handler(int sig)
+// Command FIFO is readable: drain it into cmd_buf (event loop handler)
+static void on_fifo(int fd, uint32_t events, void *ctx)
 {
-    (void)sig;
-    running = false;
+    (void)events;
+    (void)ctx;
+
+    uint64_t t0 = monotonic_us();
+    ssize_t n;
+    while (cmd_len < sizeof(cmd_buf) && (n = read(fd, cmd_buf + cmd_len, sizeof(cmd_buf) - cmd_len)) > 0)
+    {
+        cmd_len += (size_t)n;
+        if (cmd_len == sizeof(cmd_buf))
+            extract_fifo_lines(); // buffer full: make room before reading on
+        if (cmd_queue_len == CMD_BATCH_MAX)
+            break; // leave the rest in the pipe until this batch is dispatched
+    }
+    stats_record(STAGE_FIFO_READ, monotonic_us() - t0);
 }
 
-/* Find connector and mode (same logic as before) */
-static int find_connector_mode(int fd, uint32_t *out_conn, uint32_t *out_crtc, drmModeModeInfo *out_mode)
+static void close_client(int fd)
 {
-    drmModeRes *res = drmModeGetResources(fd);
-    if (!res)
-        return -1;
-    // preferred
-    for (int i = 0; i < res->count_connectors; ++i)
+    // queued commands from this client no longer get a reply
+    for (int i = 0; i < cmd_queue_len; ++i)
     {
-        drmModeConnector *conn = drmModeGetConnector(fd, res->connectors[i]);
-        if (!conn)
-            continue;
-        if (conn->connection != DRM_MODE_CONNECTED)
-        {
-            drmModeFreeConnector(conn);
-            continue;
-        }
-        for (int m = 0; m < conn->count_modes; ++m)
-        {
-            if ((int)conn->modes[m].hdisplay == PREFERRED_W && (int)conn->modes[m].vdisplay == PREFERRED_H)
-            {
-                uint32_t chosen_crtc = 0;
-                if (conn->encoder_id)
-                {
-                    drmModeEncoder *enc = drmModeGetEncoder(fd, conn->encoder_id);
-                    if (enc)
-                    {
-                        chosen_crtc = enc->crtc_id;
-                        drmModeFreeEncoder(enc);
-                    }
-                }
-                if (!chosen_crtc && res->count_crtcs > 0)
-                    chosen_crtc = res->crtcs[0];
-                *out_conn = conn->connector_id;
-                *out_crtc = chosen_crtc;
-                *out_mode = conn->modes[m];
-                drmModeFreeConnector(conn);
-                drmModeFreeResources(res);
-                return 0;
-            }
-        }
-        drmModeFreeConnector(conn);
+        if (cmd_queue[i].client_fd == fd)
+            cmd_queue[i].client_fd = -1;
     }
-    // fallback
-    for (int i = 0; i < res->count_connectors; ++i)
+    pthread_mutex_lock(&job_lock);
+    RenderJob *lists[] = {render_q.head, render_q.current, background_q.head, background_q.current, done_head};
+    for (int l = 0; l < 5; ++l)
     {
-        drmModeConnector *conn = drmModeGetConnector(fd, res->connectors[i]);
-        if (!conn)
-            continue;
-        if (conn->connection != DRM_MODE_CONNECTED)
+        for (RenderJob *j = lists[l]; j; j = j->next)
         {
-            drmModeFreeConnector(conn);
-            continue;
+            if (j->client_fd == fd)
+                j->client_fd = -1;
         }
-        if (conn->count_modes == 0)
+    }
+    pthread_mutex_unlock(&job_lock);
+    evloop_del(fd);
+    close(fd);
+}
+
+// RING handshake: reply with the ring's eventfd attached (SCM_RIGHTS) so the client can kick us
+static void send_ring_handshake(int client_fd)
+{
+    const char *reply = ring_fd >= 0 ? "OK RING" : "FAILED RING";
+    struct iovec iov = {(void *)reply, strlen(reply)};
+    union
+    {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    if (ring_fd >= 0)
+    {
+        memset(&ctrl, 0, sizeof(ctrl));
+        msg.msg_control = ctrl.buf;
+        msg.msg_controllen = sizeof(ctrl.buf);
+        struct cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_SOCKET;
+        cm->cmsg_type = SCM_RIGHTS;
+        cm->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cm), &ring_fd, sizeof(int));
+    }
+    if (sendmsg(client_fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+        ts_perror("sendmsg (ring handshake)");
+}
+
+// Control socket client sent requests (one command per packet) or hung up (event loop handler)
+static void on_client(int fd, uint32_t events, void *ctx)
+{
+    (void)events;
+    (void)ctx;
+    char pkt[CMD_MAX_LEN];
+
+    while (cmd_queue_len < CMD_BATCH_MAX)
+    {
+        ssize_t n = recv(fd, pkt, sizeof(pkt) - 1, MSG_DONTWAIT);
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK))
         {
-            drmModeFreeConnector(conn);
-            continue;
+            close_client(fd);
+            return;
         }
-        uint32_t chosen_crtc = 0;
-        if (conn->encoder_id)
+        if (n < 0)
+            break;
+
+        pkt[n] = '\0';
+        char *cmd_str = trim(pkt, (size_t)n + 1);
+        if (cmd_str && strcmp(cmd_str, "RING") == 0)
+            send_ring_handshake(fd);
+        else if (cmd_str)
+            enqueue_command("sock", cmd_str, fd, monotonic_us());
+        else
         {
-            drmModeEncoder *enc = drmModeGetEncoder(fd, conn->encoder_id);
-            if (enc)
-            {
-                chosen_crtc = enc->crtc_id;
-                drmModeFreeEncoder(enc);
-            }
+            uint64_t now = monotonic_us();
+            CmdResult res = {.status = ST_OK, .crtc_ok = true, .recv_us = now, .start_us = now};
+            send_reply(fd, "", &res);
         }
-        if (!chosen_crtc && res->count_crtcs > 0)
-            chosen_crtc = res->crtcs[0];
-        *out_conn = conn->connector_id;
-        *out_crtc = chosen_crtc;
-        *out_mode = conn->modes[0];
-        drmModeFreeConnector(conn);
-        drmModeFreeResources(res);
-        return 0;
     }
-    drmModeFreeResources(res);
-    return -1;
 }
 
-/* Create and map a dumb buffer, add FB, keep mapping pointer in fb_map */
-static int create_dumb_fb(int fd, uint32_t width, uint32_t height)
+// New control socket connections (event loop handler)
+static void on_listen(int fd, uint32_t events, void *ctx)
 {
-    struct drm_mode_create_dumb creq = {0};
-    creq.width = width;
-    creq.height = height;
-    creq.bpp = 32;
-    if (ioctl(fd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0)
+    (void)events;
+    (void)ctx;
+    int client;
+    while ((client = accept4(fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0)
     {
-        ts_perror("DRM_IOCTL_MODE_CREATE_DUMB");
-        return -1;
+        if (evloop_add(client, EPOLLIN, on_client, NULL) != 0)
+            close(client);
     }
-    dumb_handle = creq.handle;
-    stride = creq.pitch;
-    bo_size = creq.size;
-    // map
-    struct drm_mode_map_dumb mreq = {0};
-    mreq.handle = dumb_handle;
-    if (ioctl(fd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) < 0)
+}
+
+/* Control socket next to the FIFO: SOCK_SEQPACKET, one command per packet, one reply packet per
+   command. Failure is not fatal, the FIFO keeps working. */
+static int open_control_socket(void)
+{
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
     {
-        ts_perror("DRM_IOCTL_MODE_MAP_DUMB");
+        ts_perror("socket (control)");
         return -1;
     }
-    fb_map = mmap(0, bo_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mreq.offset);
-    if (fb_map == MAP_FAILED)
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", DMQ_SOCK);
+    unlink(DMQ_SOCK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, SOCK_BACKLOG) < 0)
     {
-        ts_perror("mmap");
-        fb_map = NULL;
+        ts_perror("bind/listen (control)");
+        close(fd);
         return -1;
     }
-    // create FB
-    if (drmModeAddFB(fd, width, height, 24, 32, stride, dumb_handle, &fb_id))
+    chmod(DMQ_SOCK, 0666); // allow any user to send commands
+    return fd;
+}
+
+// A ring producer found us asleep (event loop handler); the ring is drained in run_command_queue()
+static void on_ring(int fd, uint32_t events, void *ctx)
+{
+    (void)events;
+    (void)ctx;
+    uint64_t count;
+    if (read(fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+        ts_perror("read (ring eventfd)");
+}
+
+/* Shared-memory command ring next to the FIFO and socket. Failure is not fatal. */
+static void open_command_ring(void)
+{
+    cmd_ring = dmq_ring_create();
+    ring_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (cmd_ring)
+        stats_mem_add(MEM_RINGS, sizeof(DmqRing));
+    if (!cmd_ring || ring_fd < 0 || evloop_add(ring_fd, EPOLLIN, on_ring, NULL) != 0)
     {
-        ts_perror("drmModeAddFB");
-        munmap(fb_map, bo_size);
-        fb_map = NULL;
-        return -1;
+        if (cmd_ring)
+            stats_mem_add(MEM_RINGS, -(int64_t)sizeof(DmqRing));
+        ts_perror("dmarquees: command ring unavailable");
+        dmq_ring_destroy(cmd_ring);
+        cmd_ring = NULL;
+        if (ring_fd >= 0)
+            close(ring_fd);
+        ring_fd = -1;
     }
-    return 0;
 }
 
-static void destroy_dumb_fb(int fd)
+/* Daemon metrics in Prometheus text format: command counts, stage latency histograms, CRTC
+   reset failures, image cache occupancy and time since the last successful scanout. */
+static int format_metrics(char *buf, size_t size)
+{
+    int len = snprintf(buf, size,
+                       "# HELP dmarquees_commands_total Commands dispatched, by type.\n"
+                       "# TYPE dmarquees_commands_total counter\n");
+    for (int c = 0; c < CMD_TYPE_COUNT && len < (int)size; ++c)
+        len += snprintf(buf + len, size - len, "dmarquees_commands_total{type=\"%s\"} %llu\n",
+                        fromCommandType((CommandType)c), (unsigned long long)command_counts[c]);
+    if (len < (int)size)
+        len += stats_format_prometheus(buf + len, size - len);
+
+    int entries;
+    uint64_t bytes = cache_bytes(&entries);
+
+    double age = last_scanout_us ? (monotonic_us() - last_scanout_us) / 1e6 : -1;
+    if (len < (int)size)
+        len += snprintf(buf + len, size - len,
+                        "# HELP dmarquees_crtc_reset_failures_total CRTC resets that failed (display owned elsewhere).\n"
+                        "# TYPE dmarquees_crtc_reset_failures_total counter\n"
+                        "dmarquees_crtc_reset_failures_total %llu\n"
+                        "# HELP dmarquees_image_cache_entries Decoded images in the cache.\n"
+                        "# TYPE dmarquees_image_cache_entries gauge\n"
+                        "dmarquees_image_cache_entries %d\n"
+                        "# HELP dmarquees_image_cache_bytes Memory held by cached decoded images.\n"
+                        "# TYPE dmarquees_image_cache_bytes gauge\n"
+                        "dmarquees_image_cache_bytes %llu\n"
+                        "# HELP dmarquees_last_scanout_age_seconds Time since the last successful CRTC set (-1 = never).\n"
+                        "# TYPE dmarquees_last_scanout_age_seconds gauge\n"
+                        "dmarquees_last_scanout_age_seconds %.3f\n"
+                        "# HELP dmarquees_crtc_reacquire_pending Outputs waiting to reacquire the display.\n"
+                        "# TYPE dmarquees_crtc_reacquire_pending gauge\n"
+                        "dmarquees_crtc_reacquire_pending %d\n",
+                        (unsigned long long)crtc_failures_total, entries, (unsigned long long)bytes, age,
+                        __builtin_popcount(reacquire_pending));
+    if (len < (int)size)
+        len += stats_format_mem_prometheus(buf + len, size - len, g_mem_budget);
+    return len < (int)size ? len : (int)size - 1;
+}
+
+// Metrics socket connection: write one scrape and hang up (event loop handler)
+static void on_metrics_conn(int fd, uint32_t events, void *ctx)
 {
-    if (fb_id)
+    (void)events;
+    (void)ctx;
+    static char buf[METRICS_BUF_SIZE];
+    int client;
+    while ((client = accept4(fd, NULL, NULL, SOCK_CLOEXEC)) >= 0)
     {
-        drmModeRmFB(fd, fb_id);
-        fb_id = 0;
+        int len = format_metrics(buf, sizeof(buf));
+        if (send(client, buf, (size_t)len, MSG_DONTWAIT | MSG_NOSIGNAL) < 0)
+            ts_perror("send (metrics)");
+        close(client);
     }
-    if (fb_map)
+}
+
+// Rewrite the node-exporter textfile atomically (write a temp file, then rename over it)
+static void write_metrics_textfile(void)
+{
+    static char buf[METRICS_BUF_SIZE];
+    char tmp[512];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", g_metrics_file);
+
+    int len = format_metrics(buf, sizeof(buf));
+    FILE *fp = fopen(tmp, "w");
+    if (!fp)
     {
-        munmap(fb_map, bo_size);
-        fb_map = NULL;
+        ts_perror("fopen (metrics textfile)");
+        return;
     }
-    if (dumb_handle)
+    bool ok = fwrite(buf, 1, (size_t)len, fp) == (size_t)len;
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp, g_metrics_file) != 0)
     {
-        struct drm_mode_destroy_dumb dreq = {.handle = dumb_handle};
-        ioctl(fd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
-        dumb_handle = 0;
+        ts_perror("write (metrics textfile)");
+        unlink(tmp);
     }
 }
 
-static int initialize(void)
+// Textfile period elapsed (event loop handler)
+static void on_metrics_timer(int fd, uint32_t events, void *ctx)
 {
-    // ensure FIFO exists
-    if (mkfifo(CMD_FIFO, 0666) < 0)
-    {
-        if (errno != EEXIST)
-        {
-            ts_perror("mkfifo");
-            return 1;
-        }
-    }
-    chmod(CMD_FIFO, 0666); // allow any user to write commands
+    (void)events;
+    (void)ctx;
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+        write_metrics_textfile();
+}
 
-    // open DRM device
-    drm_fd = open(DEVICE_PATH, O_RDWR | O_CLOEXEC);
-    if (drm_fd < 0)
+/* Prometheus metrics: a stream socket answering every connection with one scrape, and with -M
+   a textfile for node-exporter's textfile collector. Failures are not fatal. */
+static void open_metrics(void)
+{
+    metrics_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", METRICS_SOCK);
+    unlink(METRICS_SOCK);
+    if (metrics_fd < 0 || bind(metrics_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(metrics_fd, SOCK_BACKLOG) < 0 || evloop_add(metrics_fd, EPOLLIN, on_metrics_conn, NULL) != 0)
     {
-        ts_perror("open drm");
-        return 1;
+        ts_perror("metrics socket");
+        if (metrics_fd >= 0)
+            close(metrics_fd);
+        metrics_fd = -1;
     }
+    else
+        chmod(METRICS_SOCK, 0666);
 
-    // attempt to become DRM master (recommended for daemon)
-    bool is_master = (drmSetMaster(drm_fd) == 0);
-    if (!is_master)
+    if (!g_metrics_file)
+        return;
+    metrics_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    struct itimerspec its = {{METRICS_INTERVAL_SEC, 0}, {METRICS_INTERVAL_SEC, 0}};
+    if (metrics_timer_fd < 0 || timerfd_settime(metrics_timer_fd, 0, &its, NULL) != 0 ||
+        evloop_add(metrics_timer_fd, EPOLLIN, on_metrics_timer, NULL) != 0)
     {
-        ts_perror("drmSetMaster (ignored)");
-        // continue: we may still be able to set the CRTC depending on environment
+        ts_perror("metrics timer");
+        return;
     }
+    write_metrics_textfile();
+}
 
-    // locate connector & mode
-    if (find_connector_mode(drm_fd, &conn_id, &crtc_id, &chosen_mode) != 0)
+// SIGINT/SIGTERM delivered through a signalfd (event loop handler)
+static void on_signal(int fd, uint32_t events, void *ctx)
+{
+    (void)events;
+    (void)ctx;
+    struct signalfd_siginfo si;
+    if (read(fd, &si, sizeof(si)) == sizeof(si))
     {
-        ts_fprintf(stderr, "error: Failed to find connected output\n");
-        close(drm_fd);
-        return 1;
+        ts_printf("dmarquees: signal %u received\n", si.ssi_signo);
+        running = false;
     }
+}
 
-    ts_printf("dmarquees: Selected connector %u mode %dx%d crtc %u\n", conn_id, chosen_mode.hdisplay,
-              chosen_mode.vdisplay, crtc_id);
+/* Open the command FIFO once, O_RDWR so there is always a writer and the fd never reports EOF
+   between clients, and register it with every other event source in one epoll loop. */
+static int setup_event_loop(void)
+{
+    if (evloop_init() != 0)
+        return -1;
 
-    // create persistent dumb framebuffer sized to chosen_mode
-    if (create_dumb_fb(drm_fd, chosen_mode.hdisplay, chosen_mode.vdisplay) != 0)
+    fifo_fd = open(DMQ_FIFO, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fifo_fd < 0)
     {
-        ts_fprintf(stderr, "error: Failed to create dumb FB\n");
-        close(drm_fd);
-        return 1;
+        ts_perror("open");
+        ts_error("dmarquees: FATAL - can't access command fifo\n");
+        return -1;
     }
+    if (evloop_add(fifo_fd, EPOLLIN, on_fifo, NULL) != 0)
+        return -1;
 
-    memset(fb_map, 0x00, bo_size); // Clear framebuffer (black)
+    int display_fd = display->event_fd();
+    if (display_fd >= 0 && evloop_add(display_fd, EPOLLIN, on_display_event, NULL) != 0)
+        return -1;
 
-    // Release DRM master so other apps (like MAME) can take control
-    if (is_master)
+    // SIGINT/SIGTERM become events instead of interrupting the loop
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    signal_fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signal_fd < 0 || evloop_add(signal_fd, EPOLLIN, on_signal, NULL) != 0)
     {
-        if (drmDropMaster(drm_fd) != 0)
-            ts_fprintf(stderr, "warning: drmDropMaster(1) failed (%s)\n", strerror(errno));
-        else
-            ts_printf("dmarquees: DRM master dropped - MAME can safely start.\n");
+        ts_perror("signalfd");
+        return -1;
     }
 
-    show_default_marquee();     // draw default marquee (RetroPie NA frontend)
+    uevent_fd = open_uevent_socket();   // hotplug notifications (optional)
+    if (uevent_fd >= 0)
+        evloop_add(uevent_fd, EPOLLIN, on_uevent, NULL);
 
-    return 0;
-}
+    sock_fd = open_control_socket();    // acknowledged commands (optional)
+    if (sock_fd >= 0)
+        evloop_add(sock_fd, EPOLLIN, on_listen, NULL);
 
-static bool show_game_marquee(const char* cmd_str)
-{
-    char imgpath[512];
-    snprintf(imgpath, sizeof(imgpath), "%s/%s.png", IMAGE_DIR, cmd_str);
+    open_command_ring();                // lock-free posts from plugins (optional)
+    open_metrics();                     // Prometheus scrapes (optional)
 
-    struct stat st;
-    if (stat(imgpath, &st) != 0)
+    reacquire_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (reacquire_fd < 0 || evloop_add(reacquire_fd, EPOLLIN, on_reacquire_timer, NULL) != 0)
     {
-        ts_fprintf(stderr, "warning: image missing: %s\n", imgpath);
-        return false;
+        ts_perror("timerfd_create");
+        return -1;
+    }
+    if (reacquire_pending)
+    {
+        reacquire_delay_ms = CRTC_RETRY_MIN_MSEC;   // a reset failed during startup
+        arm_reacquire_timer(reacquire_delay_ms);
     }
 
-    int iw = 0, ih = 0;
-
-    if (image)
-        free(image);
+    return start_workers();
+}
 
-    image = load_png_rgba(imgpath, &iw, &ih);
+static void prefault_stack(void)
+{
+    volatile char buf[RT_STACK_PREFAULT];
+    memset((char *)buf, 0, sizeof(buf));
+}
 
-    if (image == NULL)
+/* -R: run the command path (main loop, render worker and its decode threads, which inherit the
+   policy and affinity) at SCHED_FIFO, optionally pinned to one core, with all memory locked.
+   Freed decode buffers are kept in one pre-faulted, locked heap and reused, so a marquee update
+   during an emulator launch neither waits for a CPU nor takes page faults. */
+static void enter_realtime_mode(void)
+{
+    if (g_rt_cpu >= 0)
     {
-        ts_fprintf(stderr, "error: png load failed %s\n", imgpath);
-        return false;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(g_rt_cpu, &set);
+        if (sched_setaffinity(0, sizeof(set), &set) != 0)
+            ts_perror("sched_setaffinity");
     }
 
-    ts_printf("dmarquees: game marquee loaded: %s.png\n", cmd_str);
+    // one arena, no trimming, large buffers from the heap rather than fresh mmaps
+    mallopt(M_ARENA_MAX, 1);
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_THRESHOLD, 32 << 20);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+        ts_perror("mlockall");
 
-    // clear screen to black first and blit ROM marquee
-    if (fb_map)
+    char *heap = malloc(RT_HEAP_PREFAULT);
+    if (heap)
     {
-        uint32_t* fbptr = (uint32_t*)fb_map;
-        int fb_w = chosen_mode.hdisplay;
-        int fb_h = chosen_mode.vdisplay;
-        int stride_pixels = stride / 4;
-        int dest_x = 0;
-
-        // Clear screen before blit (to avoid remnants)
-        memset(fb_map, 0, bo_size);
-
-        scale_and_blit_to_xrgb(image, iw, ih, fbptr, fb_w, fb_h, stride_pixels, dest_x);
-        try_reset_crtc();
+        for (size_t i = 0; i < RT_HEAP_PREFAULT; i += 4096)
+            heap[i] = 0;
+        free(heap); // stays in the (locked) heap for the decode buffers
     }
-    return true;
+    prefault_stack();
+
+    struct sched_param sp = {.sched_priority = g_rt_prio};
+    if (sched_setscheduler(0, SCHED_FIFO, &sp) != 0)
+        ts_perror("sched_setscheduler");
+    else
+        ts_printf("dmarquees: real-time mode: SCHED_FIFO priority %d, cpu %d, memory locked\n", g_rt_prio, g_rt_cpu);
 }
 
 int main(int argc, char **argv)
 {
     ts_printf("dmarquees: v%s starting...\n", VERSION);
 
-    // parse command line for frontend mode
+    // parse command line for frontend mode and outputs
     int parse_result = parseFrontendModeArg(argc, argv);
     if (parse_result != 0)
         return parse_result;
 
+    // log writer thread first: it must not inherit the real-time policy
+    if (log_start() != 0)
+        ts_fprintf(stderr, "warning: async logging unavailable, writing log lines synchronously\n");
+
     ts_printf("dmarquees: frontend=%s\n", fromFrontendMode(g_frontend_mode));
+    display = g_headless_w ? &headless_backend : &drm_backend;
+
+    if (g_timeline_file && trace_open(g_timeline_file) != 0)
+        ts_perror(g_timeline_file);
+    else if (g_timeline_file)
+        ts_printf("dmarquees: writing timeline to %s\n", g_timeline_file);
+    trace_thread_name("main");
 
-    signal(SIGINT, sigint_handler);
+    if (g_rt_prio > 0)
+        enter_realtime_mode(); // before any other thread is created, so they all inherit it
 
     if (initialize() != 0)
+    {
+        trace_close();
+        log_stop();
         return 1;
+    }
 
-    ts_printf("dmarquees: entering main loop\n");
+    if (g_trace_file)
+        open_trace();
 
-    CommandType command = CMD_UNKNOWN;
-    char buf[128];
-    char* cmd_str = NULL;
-    int spam_count = 0;
+    if (setup_event_loop() == 0)
+        ts_printf("dmarquees: entering main loop, listening on %s\n", DMQ_FIFO);
+    else
+        running = false;
 
-    // main loop: read FIFO lines and act on them
+    // main loop: block until a command, signal, uevent or timer arrives (no idle wakeups)
     while (running)
     {
-        int fifo = open(CMD_FIFO, O_RDONLY);
-        if (fifo < 0)
-        {
-            ts_perror("open");
-            ts_fprintf(stderr, "dmarquees: FATAL - can't access command fifo\n");
-            break;  // get out of main loop
-        }
-
-        if (spam_count++ < 5)
-            ts_printf("dmarquees (%d): read on %s\n", spam_count, CMD_FIFO);
-        else if (spam_count == 6)
-            ts_printf("dmarquees: further logging for fifo suppressed\n");
-
-        ssize_t read_len = read(fifo, buf, sizeof(buf) - 1);
-
-        close(fifo);
-
-        if (read_len > 0)
-        {
-            // Looks like we have a command!
-            cmd_str = trim(buf,read_len);
-
-            if (!cmd_str)
-                continue;   // oops, I guess not!
-        }
-        else if (g_ra_init_hold && (time(NULL) > g_ra_init_hold))
-        {
-            ts_printf("dmarquees: retrying crtc now...\n");
-            if (try_reset_crtc())
-                g_ra_init_hold = 0;                 // clear hold
-            else
-                g_ra_init_hold = time(NULL) + 1;    // try again in 1 second
-
-            continue;
-        }
-        else
-        {
-            usleep(FIFO_RETRY_DELAY_MSEC * 1000);
-            continue;
-        }
-
-        ts_printf("dmarquees: command received: '%s'\n", cmd_str);
-
-        command = toCommandType(cmd_str);
-
-        switch (command)
-        {
-        case CMD_RA:
-            g_frontend_mode = eRA;
-            ts_printf("dmarquees: frontend mode changed to RA\n");
-            show_default_marquee();
-            break;
-
-        case CMD_SA:
-            g_frontend_mode = eSA;
-            ts_printf("dmarquees: frontend mode changed to SA\n");
-            show_default_marquee();
-            break;
-
-        case CMD_NA:
-            g_frontend_mode = eNA;
-            ts_printf("dmarquees: frontend mode changed to NA\n");
-            show_default_marquee();
-            break;
-
-        case CMD_EXIT:
-            running = false;
-            break;
-
-        case CMD_CLEAR:
-            show_default_marquee();
-            break;
-
-        case CMD_RESET:
-            try_reset_crtc();
-            break;
-
-        case CMD_ROM:
-            // If we reach here, it's either eROM or an unknown command - treat as ROM shortname
-            if (game_has_multiple_screens(cmd_str))
-            {
-                ts_printf("dmarquees: Skipping multi-screen game: %s\n", cmd_str);
-                break;
-            }
-
-            // otherwise treat as rom shortname
-            if (!show_game_marquee(cmd_str))
-            {
-                // Fallback: show default marquee
-                show_default_marquee();
-            }
-            break;
-
-        default:    // never happens
-            break;
-        }
+        // don't sleep if a ring post slipped in after the last drain
+        evloop_run_once(cmd_ring && dmq_ring_prepare_wait(cmd_ring) ? 0 : -1);
+        run_command_queue();
     }
 
     // cleanup
-    destroy_dumb_fb(drm_fd);
-    if (drm_fd >= 0)
+    stop_workers();
+    cache_clear();
+    if (uevent_fd >= 0)
+        close(uevent_fd);
+    if (signal_fd >= 0)
+        close(signal_fd);
+    if (reacquire_fd >= 0)
+        close(reacquire_fd);
+    if (fifo_fd >= 0)
+        close(fifo_fd);
+    if (sock_fd >= 0)
     {
-        drmDropMaster(drm_fd);
-        close(drm_fd);
+        close(sock_fd);
+        unlink(DMQ_SOCK);
+    }
+    dmq_ring_destroy(cmd_ring);
+    if (metrics_fd >= 0)
+    {
+        close(metrics_fd);
+        unlink(METRICS_SOCK);
+    }
+    if (metrics_timer_fd >= 0)
+        close(metrics_timer_fd);
+    if (trace_fp)
+        fclose(trace_fp);
+    if (ring_fd >= 0)
+        close(ring_fd);
+    evloop_close();
+    for (int i = 0; i < num_outputs; ++i)
+    {
+        output_set_image(&outputs[i], NULL);
+        destroy_output_fb(&outputs[i]);
     }
-    unlink(CMD_FIFO);
+    display->close();
+    unlink(DMQ_FIFO);
+    trace_close();
     ts_printf("dmarquees: exiting\n");
+    log_stop();
     return 0;
 }
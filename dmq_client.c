@@ -0,0 +1,138 @@
+#define _GNU_SOURCE
+#include "dmq_client.h"
+#include "dmq_ring.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define DMQ_REPLY_TIMEOUT_SEC 10
+
+static int conn_fd = -1;
+static pthread_mutex_t conn_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// indexed by DmqStatus
+static const char *const status_names[] = {
+    "OK", "SHOWN", "MISSING", "FAILED", "SKIPPED_MULTISCREEN", "SUPERSEDED", "BAD_OUTPUT",
+};
+
+static int connect_locked(void)
+{
+    if (conn_fd >= 0)
+        return 0;
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, DMQ_SOCK, sizeof(addr.sun_path) - 1);
+    struct timeval tv = {DMQ_REPLY_TIMEOUT_SEC, 0};
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    conn_fd = fd;
+    return 0;
+}
+
+static void close_locked(void)
+{
+    if (conn_fd >= 0)
+        close(conn_fd);
+    conn_fd = -1;
+}
+
+static DmqStatus parse_status(const char *reply)
+{
+    size_t len = strcspn(reply, " ");
+    for (size_t i = 0; i < sizeof(status_names) / sizeof(status_names[0]); ++i)
+    {
+        if (strlen(status_names[i]) == len && strncmp(reply, status_names[i], len) == 0)
+            return (DmqStatus)i;
+    }
+    return DMQ_ERROR;
+}
+
+int dmq_open(void)
+{
+    pthread_mutex_lock(&conn_lock);
+    int r = connect_locked();
+    pthread_mutex_unlock(&conn_lock);
+    return r;
+}
+
+void dmq_close(void)
+{
+    pthread_mutex_lock(&conn_lock);
+    close_locked();
+    pthread_mutex_unlock(&conn_lock);
+}
+
+DmqStatus dmq_command(const char *cmd, char *reply, size_t size)
+{
+    char buf[DMQ_REPLY_MAX];
+    size_t len = strlen(cmd);
+    ssize_t n = -1;
+
+    pthread_mutex_lock(&conn_lock);
+    // one retry on a fresh connection: the daemon may have restarted since the last call
+    for (int attempt = 0; attempt < 2 && n < 0; ++attempt)
+    {
+        if (connect_locked() != 0)
+            break;
+        if (send(conn_fd, cmd, len, MSG_NOSIGNAL) != (ssize_t)len)
+        {
+            close_locked();
+            continue;
+        }
+        n = recv(conn_fd, buf, sizeof(buf) - 1, 0);
+        if (n <= 0)
+        {
+            bool timed_out = n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK);
+            // a late reply must not be taken for the next command's: drop the connection
+            close_locked();
+            n = -1;
+            if (timed_out)
+                break;
+        }
+    }
+    pthread_mutex_unlock(&conn_lock);
+
+    if (n < 0)
+        return DMQ_ERROR;
+    buf[n] = '\0';
+    if (reply && size > 0)
+        snprintf(reply, size, "%s", buf);
+    return parse_status(buf);
+}
+
+DmqStatus dmq_show(const char *rom)
+{
+    return dmq_command(rom, NULL, 0);
+}
+
+DmqStatus dmq_mode(const char *mode)
+{
+    return dmq_command(mode, NULL, 0);
+}
+
+DmqStatus dmq_clear(void)
+{
+    return dmq_command("CLEAR", NULL, 0);
+}
+
+DmqStatus dmq_prefetch(const char *rom)
+{
+    char cmd[DMQ_RING_CMD_LEN];
+    snprintf(cmd, sizeof(cmd), "PREFETCH %s", rom);
+    return dmq_command(cmd, NULL, 0);
+}
@@ -0,0 +1,47 @@
+#ifndef DMQ_CLIENT_H
+#define DMQ_CLIENT_H
+#include <stddef.h>
+
+/* libdmarquees: C API over the daemon's control socket (/tmp/dmarquees.sock). One persistent
+   connection per process is opened on first use and re-opened if the daemon restarts. Each
+   call sends one command and waits for its reply; calls are serialised (thread-safe). */
+
+// Reply status, same order as the daemon's CmdStatus
+typedef enum
+{
+    DMQ_ERROR = -1,     // IPC failure (daemon not running, timeout, ...)
+    DMQ_OK = 0,
+    DMQ_SHOWN,
+    DMQ_MISSING,
+    DMQ_FAILED,
+    DMQ_MULTISCREEN,
+    DMQ_SUPERSEDED,
+    DMQ_BAD_OUTPUT
+} DmqStatus;
+
+#define DMQ_SOCK "/tmp/dmarquees.sock"  // control socket (commands with replies, RING handshake)
+#define DMQ_FIFO "/tmp/dmarquees_cmd"   // command FIFO (one command per line, no reply)
+#define DMQ_REPLY_MAX 4096  // STATS replies are multi-line
+
+// Connect now instead of on the first call. Returns 0 or -1.
+int dmq_open(void);
+
+void dmq_close(void);
+
+/* Send a raw command ("sf", "1:CLEAR", "RESET", ...). The reply line (status, command and
+   latency breakdown) is copied to reply if it is not NULL. */
+DmqStatus dmq_command(const char *cmd, char *reply, size_t size);
+
+// Show the marquee of a ROM shortname (the default marquee if there is none)
+DmqStatus dmq_show(const char *rom);
+
+// Switch the frontend mode: "RA", "SA" or "NA"
+DmqStatus dmq_mode(const char *mode);
+
+// Show the default marquee
+DmqStatus dmq_clear(void);
+
+// Decode a ROM marquee into the daemon's image cache so a later dmq_show() skips the decode
+DmqStatus dmq_prefetch(const char *rom);
+
+#endif
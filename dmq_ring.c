@@ -0,0 +1,227 @@
+#define _GNU_SOURCE
+#include "dmq_ring.h"
+#include "dmq_client.h"
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static DmqRing *map_ring(int fd)
+{
+    void *p = mmap(NULL, sizeof(DmqRing), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+DmqRing *dmq_ring_create(void)
+{
+    // a fresh object each start: clients still mapping the old one see alive == 0
+    shm_unlink(DMQ_RING_SHM);
+    int fd = shm_open(DMQ_RING_SHM, O_CREAT | O_EXCL | O_RDWR | O_CLOEXEC, 0666);
+    if (fd < 0)
+        return NULL;
+    fchmod(fd, 0666); // allow any user to post commands (like the FIFO)
+    if (ftruncate(fd, sizeof(DmqRing)) != 0)
+    {
+        close(fd);
+        shm_unlink(DMQ_RING_SHM);
+        return NULL;
+    }
+
+    DmqRing *ring = map_ring(fd);
+    if (!ring)
+    {
+        shm_unlink(DMQ_RING_SHM);
+        return NULL;
+    }
+    ring->magic = DMQ_RING_MAGIC;
+    ring->version = DMQ_RING_VERSION;
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    atomic_init(&ring->waiting, 0);
+    for (uint32_t i = 0; i < DMQ_RING_SLOTS; ++i)
+        atomic_init(&ring->slots[i].seq, i);
+    atomic_store_explicit(&ring->alive, 1, memory_order_release);
+    return ring;
+}
+
+DmqRing *dmq_ring_attach(void)
+{
+    int fd = shm_open(DMQ_RING_SHM, O_RDWR | O_CLOEXEC, 0);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(DmqRing))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    DmqRing *ring = map_ring(fd);
+    if (ring && (ring->magic != DMQ_RING_MAGIC || ring->version != DMQ_RING_VERSION ||
+                 !atomic_load_explicit(&ring->alive, memory_order_acquire)))
+    {
+        dmq_ring_unmap(ring);
+        return NULL;
+    }
+    return ring;
+}
+
+void dmq_ring_unmap(DmqRing *ring)
+{
+    if (ring)
+        munmap(ring, sizeof(DmqRing));
+}
+
+void dmq_ring_destroy(DmqRing *ring)
+{
+    if (!ring)
+        return;
+    atomic_store_explicit(&ring->alive, 0, memory_order_release);
+    dmq_ring_unmap(ring);
+    shm_unlink(DMQ_RING_SHM);
+}
+
+int dmq_ring_push(DmqRing *ring, const char *cmd)
+{
+    if (!atomic_load_explicit(&ring->alive, memory_order_acquire))
+        return -1;
+
+    // claim a slot: its seq equals our position once the consumer has freed it
+    uint32_t pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    DmqRingSlot *slot;
+    for (;;)
+    {
+        slot = &ring->slots[pos & (DMQ_RING_SLOTS - 1)];
+        int32_t diff = (int32_t)(atomic_load_explicit(&slot->seq, memory_order_acquire) - pos);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&ring->head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return -1; // full
+        else
+            pos = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    }
+
+    size_t len = strnlen(cmd, DMQ_RING_CMD_LEN - 1);
+    memcpy(slot->cmd, cmd, len);
+    slot->cmd[len] = '\0';
+
+    /* publish, then check the waiting flag; both seq_cst so that either we see the consumer's
+       flag or it sees our slot (see dmq_ring_prepare_wait) */
+    atomic_store_explicit(&slot->seq, pos + 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&ring->waiting, memory_order_seq_cst) && atomic_exchange(&ring->waiting, 0))
+        return 1;
+    return 0;
+}
+
+bool dmq_ring_pop(DmqRing *ring, char *cmd)
+{
+    uint32_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    DmqRingSlot *slot = &ring->slots[pos & (DMQ_RING_SLOTS - 1)];
+    if (atomic_load_explicit(&slot->seq, memory_order_acquire) != pos + 1)
+        return false;
+
+    memcpy(cmd, slot->cmd, DMQ_RING_CMD_LEN);
+    cmd[DMQ_RING_CMD_LEN - 1] = '\0';
+    atomic_store_explicit(&slot->seq, pos + DMQ_RING_SLOTS, memory_order_release); // free for the next lap
+    atomic_store_explicit(&ring->tail, pos + 1, memory_order_relaxed);
+    return true;
+}
+
+bool dmq_ring_prepare_wait(DmqRing *ring)
+{
+    atomic_store_explicit(&ring->waiting, 1, memory_order_seq_cst);
+    uint32_t pos = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    return atomic_load_explicit(&ring->slots[pos & (DMQ_RING_SLOTS - 1)].seq, memory_order_seq_cst) == pos + 1;
+}
+
+void dmq_ring_end_wait(DmqRing *ring)
+{
+    atomic_store_explicit(&ring->waiting, 0, memory_order_relaxed);
+}
+
+// RING handshake on the control socket: the reply packet carries the daemon's eventfd
+static int receive_wake_fd(void)
+{
+    int s = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (s < 0)
+        return -1;
+
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, DMQ_SOCK, sizeof(addr.sun_path) - 1);
+    if (connect(s, (struct sockaddr *)&addr, sizeof(addr)) != 0 || send(s, "RING", 4, MSG_NOSIGNAL) != 4)
+    {
+        close(s);
+        return -1;
+    }
+
+    char reply[64];
+    union
+    {
+        struct cmsghdr hdr;
+        char buf[CMSG_SPACE(sizeof(int))];
+    } ctrl;
+    struct iovec iov = {reply, sizeof(reply) - 1};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = ctrl.buf;
+    msg.msg_controllen = sizeof(ctrl.buf);
+
+    int fd = -1;
+    ssize_t n = recvmsg(s, &msg, MSG_CMSG_CLOEXEC);
+    struct cmsghdr *cm = n > 0 ? CMSG_FIRSTHDR(&msg) : NULL;
+    if (cm && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS)
+        memcpy(&fd, CMSG_DATA(cm), sizeof(fd));
+    if (fd >= 0 && strncmp(reply, "OK", 2) != 0)
+    {
+        close(fd);
+        fd = -1;
+    }
+    close(s);
+    return fd;
+}
+
+int dmq_client_open(DmqClient *c)
+{
+    c->ring = NULL;
+    c->wake_fd = receive_wake_fd();
+    if (c->wake_fd < 0)
+        return -1;
+    c->ring = dmq_ring_attach();
+    if (!c->ring)
+    {
+        dmq_client_close(c);
+        return -1;
+    }
+    return 0;
+}
+
+int dmq_client_post(DmqClient *c, const char *cmd)
+{
+    int r = dmq_ring_push(c->ring, cmd);
+    if (r > 0)
+    {
+        uint64_t one = 1;
+        if (write(c->wake_fd, &one, sizeof(one)) != sizeof(one))
+            return -1;
+    }
+    return r < 0 ? -1 : 0;
+}
+
+void dmq_client_close(DmqClient *c)
+{
+    dmq_ring_unmap(c->ring);
+    c->ring = NULL;
+    if (c->wake_fd >= 0)
+        close(c->wake_fd);
+    c->wake_fd = -1;
+}
@@ -0,0 +1,82 @@
+#ifndef DMQ_RING_H
+#define DMQ_RING_H
+#include <stdalign.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Shared-memory command ring between frontend plugins (producers) and dmarquees (consumer).
+   A bounded MPSC queue in /dev/shm: posting a command is a CAS on head, a copy and one release
+   store. The daemon only needs an eventfd kick when it is about to sleep (waiting flag set);
+   while it is busy draining, posts cost no syscall at all. The eventfd is handed to clients
+   over the control socket (SCM_RIGHTS) by the RING handshake. */
+
+#define DMQ_RING_SHM "/dmarquees.ring"      // shm_open name (/dev/shm/dmarquees.ring)
+#define DMQ_RING_MAGIC 0x444d5152u          // "DMQR"
+#define DMQ_RING_VERSION 1
+#define DMQ_RING_SLOTS 64                   // power of two
+#define DMQ_RING_CMD_LEN 256
+
+typedef struct
+{
+    _Atomic uint32_t seq;       // == position: free for that producer, position + 1: filled
+    char cmd[DMQ_RING_CMD_LEN];
+} DmqRingSlot;
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t version;
+    _Atomic uint32_t alive;     // cleared by the daemon on exit; clients must reconnect
+    _Atomic uint32_t waiting;   // consumer is (about to be) asleep: the next producer kicks it
+    alignas(64) _Atomic uint32_t head;  // next position to claim (producers)
+    alignas(64) _Atomic uint32_t tail;  // next position to consume (daemon)
+    alignas(64) DmqRingSlot slots[DMQ_RING_SLOTS];
+} DmqRing;
+
+/* ring primitives (daemon and client) */
+
+// Create (or reset) the ring; the daemon owns it. Returns NULL on error.
+DmqRing *dmq_ring_create(void);
+
+// Map an existing ring created by the daemon. Returns NULL if it is missing or incompatible.
+DmqRing *dmq_ring_attach(void);
+
+void dmq_ring_unmap(DmqRing *ring);
+
+// Daemon exit: mark the ring dead for attached clients, unmap and unlink it
+void dmq_ring_destroy(DmqRing *ring);
+
+/* Append cmd (truncated to DMQ_RING_CMD_LEN - 1). Returns 1 if the consumer must be woken,
+   0 if not, -1 if the ring is full or the daemon has gone. */
+int dmq_ring_push(DmqRing *ring, const char *cmd);
+
+// Pop the oldest command into cmd (size >= DMQ_RING_CMD_LEN). Returns false when empty.
+bool dmq_ring_pop(DmqRing *ring, char *cmd);
+
+/* Consumer going to sleep: set the waiting flag, then report whether commands slipped in
+   meanwhile (if so, drain instead of sleeping). */
+bool dmq_ring_prepare_wait(DmqRing *ring);
+
+// Consumer awake: producers no longer need to kick it
+void dmq_ring_end_wait(DmqRing *ring);
+
+/* client library (frontend plugins); no dependencies besides libc */
+
+typedef struct
+{
+    DmqRing *ring;
+    int wake_fd;    // daemon's eventfd
+} DmqClient;
+
+// Connect to the running daemon: RING handshake for the eventfd, then map the ring. 0 or -1.
+int dmq_client_open(DmqClient *c);
+
+/* Post one command (e.g. "sf", "1:CLEAR"). Returns 0, or -1 if the ring is full or the daemon
+   restarted (close and reopen the client). */
+int dmq_client_post(DmqClient *c, const char *cmd);
+
+void dmq_client_close(DmqClient *c);
+
+#endif
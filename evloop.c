@@ -0,0 +1,103 @@
+#include "evloop.h"
+#include "helpers.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#define EVLOOP_MAX_EVENTS 16
+
+/* Handlers are indexed by fd; a slot with cb == NULL is free */
+typedef struct
+{
+    EvHandler cb;
+    void *ctx;
+} EvSlot;
+
+static int ep_fd = -1;
+static EvSlot *slots = NULL;
+static int num_slots = 0;
+
+int evloop_init(void)
+{
+    ep_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (ep_fd < 0)
+    {
+        ts_perror("epoll_create1");
+        return -1;
+    }
+    return 0;
+}
+
+int evloop_add(int fd, uint32_t events, EvHandler cb, void *ctx)
+{
+    if (fd < 0 || !cb)
+        return -1;
+    if (fd >= num_slots)
+    {
+        int n = fd + 16;
+        EvSlot *grown = realloc(slots, sizeof(EvSlot) * n);
+        if (!grown)
+            return -1;
+        memset(grown + num_slots, 0, sizeof(EvSlot) * (n - num_slots));
+        slots = grown;
+        num_slots = n;
+    }
+
+    struct epoll_event ev = {.events = events, .data.fd = fd};
+    if (epoll_ctl(ep_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        ts_perror("epoll_ctl ADD");
+        return -1;
+    }
+    slots[fd].cb = cb;
+    slots[fd].ctx = ctx;
+    return 0;
+}
+
+int evloop_mod(int fd, uint32_t events)
+{
+    struct epoll_event ev = {.events = events, .data.fd = fd};
+    return epoll_ctl(ep_fd, EPOLL_CTL_MOD, fd, &ev);
+}
+
+void evloop_del(int fd)
+{
+    if (fd < 0 || fd >= num_slots || !slots[fd].cb)
+        return;
+    epoll_ctl(ep_fd, EPOLL_CTL_DEL, fd, NULL);
+    slots[fd].cb = NULL;
+    slots[fd].ctx = NULL;
+}
+
+int evloop_run_once(int timeout_ms)
+{
+    struct epoll_event events[EVLOOP_MAX_EVENTS];
+    int n = epoll_wait(ep_fd, events, EVLOOP_MAX_EVENTS, timeout_ms);
+    if (n < 0)
+    {
+        if (errno != EINTR)
+            ts_perror("epoll_wait");
+        return 0;
+    }
+
+    for (int i = 0; i < n; ++i)
+    {
+        int fd = events[i].data.fd;
+        // a handler earlier in this batch may have unregistered fd
+        if (fd < num_slots && slots[fd].cb)
+            slots[fd].cb(fd, events[i].events, slots[fd].ctx);
+    }
+    return n;
+}
+
+void evloop_close(void)
+{
+    if (ep_fd >= 0)
+        close(ep_fd);
+    ep_fd = -1;
+    free(slots);
+    slots = NULL;
+    num_slots = 0;
+}
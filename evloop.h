@@ -0,0 +1,26 @@
+#ifndef EVLOOP_H
+#define EVLOOP_H
+#include <stdint.h>
+#include <sys/epoll.h>
+
+// Callback for a registered fd; events is the EPOLL* mask that fired
+typedef void (*EvHandler)(int fd, uint32_t events, void *ctx);
+
+// Create the epoll instance. Returns 0 on success, -1 on error.
+int evloop_init(void);
+
+// Register fd for events (EPOLLIN, ...); cb is called with ctx when they fire
+int evloop_add(int fd, uint32_t events, EvHandler cb, void *ctx);
+
+// Change the event mask of a registered fd
+int evloop_mod(int fd, uint32_t events);
+
+// Unregister fd (call before closing it)
+void evloop_del(int fd);
+
+// Wait up to timeout_ms (-1 = forever) and dispatch ready fds. Returns events handled, 0 on timeout.
+int evloop_run_once(int timeout_ms);
+
+void evloop_close(void);
+
+#endif
@@ -0,0 +1,213 @@
+#define _GNU_SOURCE
+#include "display.h"
+#include <errno.h>
+#include <png.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+/* Headless display backend (-H WxH[@HZ]): every output is a virtual connector with a single
+   mode, framebuffers are anonymous memory and a CRTC set is a "scanout" that optionally dumps
+   the frame (-d DIR as PNG, -d raw:DIR as the framebuffer bytes). No master to fight over. */
+
+static char connectors[MAX_OUTPUTS][32];   // virtual connector names, index + 1 = id
+static uint32_t next_fb_id = 1;
+static unsigned frame_seq = 0;
+
+static int headless_open(void)
+{
+    ts_printf("dmarquees: headless display %dx%d@%d%s%s\n", g_headless_w, g_headless_h, g_headless_hz,
+              g_frame_dump_dir ? ", frames dumped to " : "", g_frame_dump_dir ? g_frame_dump_dir : "");
+    return 0;
+}
+
+static void headless_close(void)
+{
+}
+
+// Connector named by -o (any name is accepted), or "Virtual-1"; ids stay stable across re-probes
+static int headless_find_connector_mode(Output *out)
+{
+    const char *name = out->want ? out->want : "Virtual-1";
+    int slot = 0;
+    while (slot < MAX_OUTPUTS && connectors[slot][0] && strcmp(connectors[slot], name) != 0)
+        slot++;
+    if (slot == MAX_OUTPUTS)
+        return -1;
+    snprintf(connectors[slot], sizeof(connectors[slot]), "%s", name);
+
+    drmModeModeInfo *m = &out->mode;
+    memset(m, 0, sizeof(*m));
+    m->hdisplay = m->htotal = (uint16_t)g_headless_w;
+    m->vdisplay = m->vtotal = (uint16_t)g_headless_h;
+    m->vrefresh = (uint32_t)g_headless_hz;
+    m->clock = (uint32_t)((uint64_t)g_headless_w * g_headless_h * g_headless_hz / 1000);
+    snprintf(m->name, sizeof(m->name), "%dx%d", g_headless_w, g_headless_h);
+
+    out->conn_id = (uint32_t)slot + 1;
+    out->crtc_id = (uint32_t)slot + 1;
+    out->pipe = slot;
+    snprintf(out->name, sizeof(out->name), "%s", name);
+    return 0;
+}
+
+static int headless_create_fb(Output *o)
+{
+    // the cheapest layouts for the blitter: decoded RGBA bytes as is, or RGB565 with -b 16
+    o->format = g_fb_bpp == 16 ? PIX_RGB565 : PIX_XBGR8888;
+    o->stride = ((uint32_t)o->mode.hdisplay * (uint32_t)pixel_format_bpp(o->format) / 8 + 63) & ~63u;
+    o->bo_size = (uint64_t)o->stride * o->mode.vdisplay;
+    o->fb_map = mmap(NULL, o->bo_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (o->fb_map == MAP_FAILED)
+    {
+        ts_perror("mmap (headless fb)");
+        o->fb_map = NULL;
+        return -1;
+    }
+    o->fb_id = next_fb_id++;
+    return 0;
+}
+
+static void headless_destroy_fb(Output *o)
+{
+    if (o->fb_map)
+    {
+        munmap(o->fb_map, o->bo_size);
+        o->fb_map = NULL;
+    }
+    o->fb_id = 0;
+}
+
+static bool headless_acquire(void)
+{
+    return true;
+}
+
+static bool headless_release(void)
+{
+    return true;
+}
+
+// One framebuffer row as 8-bit RGB
+static void row_to_rgb(const Output *o, const uint8_t *src, uint8_t *rgb)
+{
+    for (int x = 0; x < o->mode.hdisplay; ++x)
+    {
+        uint8_t *d = rgb + x * 3;
+        if (o->format == PIX_RGB565)
+        {
+            uint16_t p = ((const uint16_t *)src)[x];
+            d[0] = (uint8_t)((p >> 11) << 3);
+            d[1] = (uint8_t)(((p >> 5) & 0x3f) << 2);
+            d[2] = (uint8_t)((p & 0x1f) << 3);
+        }
+        else if (o->format == PIX_XRGB8888)
+        {
+            d[0] = src[x * 4 + 2];
+            d[1] = src[x * 4 + 1];
+            d[2] = src[x * 4 + 0];
+        }
+        else
+            memcpy(d, src + x * 4, 3);
+    }
+}
+
+static int dump_png(const Output *o, FILE *fp)
+{
+    png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+    png_infop info = png ? png_create_info_struct(png) : NULL;
+    uint8_t *rgb = malloc((size_t)o->mode.hdisplay * 3);
+    if (!png || !info || !rgb)
+        goto fail;
+    if (setjmp(png_jmpbuf(png)))    // must stand alone: setjmp in a larger expression is undefined
+        goto fail;
+    png_init_io(png, fp);
+    png_set_compression_level(png, 1); // dumps are for inspection, keep them fast
+    png_set_IHDR(png, info, o->mode.hdisplay, o->mode.vdisplay, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+                 PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+    png_write_info(png, info);
+    for (int y = 0; y < o->mode.vdisplay; ++y)
+    {
+        row_to_rgb(o, (const uint8_t *)o->fb_map + (size_t)y * o->stride, rgb);
+        png_write_row(png, rgb);
+    }
+    png_write_end(png, NULL);
+    png_destroy_write_struct(&png, &info);
+    free(rgb);
+    return 0;
+
+fail:
+    png_destroy_write_struct(&png, &info);
+    free(rgb);
+    return -1;
+}
+
+/* Write the frame as it would be scanned out. The render worker may already be blitting the
+   next image, exactly as with a real dumb buffer, so a dump can show a partial update. */
+static void dump_frame(const Output *o)
+{
+    static const char *const fourcc[] = {"XR24", "XB24", "AB24", "RG16"};
+    char path[512];
+    if (g_frame_dump_raw)
+        snprintf(path, sizeof(path), "%s/%s-%06u-%dx%d-%s-%u.raw", g_frame_dump_dir, o->name, frame_seq,
+                 o->mode.hdisplay, o->mode.vdisplay, fourcc[o->format], o->stride);
+    else
+        snprintf(path, sizeof(path), "%s/%s-%06u.png", g_frame_dump_dir, o->name, frame_seq);
+
+    FILE *fp = fopen(path, "wb");
+    if (!fp)
+    {
+        ts_perror(path);
+        return;
+    }
+    int rc = g_frame_dump_raw ? (fwrite(o->fb_map, 1, o->bo_size, fp) == o->bo_size ? 0 : -1) : dump_png(o, fp);
+    if (fclose(fp) != 0 || rc != 0)
+        ts_fprintf(stderr, "warning: failed to dump frame %s\n", path);
+}
+
+static int headless_set_crtc(Output *o)
+{
+    if (!o->fb_map)
+    {
+        errno = ENOENT;
+        return -1;
+    }
+    frame_seq++;
+    if (g_frame_dump_dir)
+        dump_frame(o);
+    return 0;
+}
+
+/* Vblanks are ticks of the -H refresh rate on the monotonic clock: the next one is reported
+   at once, with its (future) time */
+static int headless_request_vblank(Output *o, void *data)
+{
+    uint64_t period_us = 1000000u / (o->mode.vrefresh ? o->mode.vrefresh : 60);
+    display_vblank(data, (monotonic_us() / period_us + 1) * period_us);
+    return 0;
+}
+
+static int headless_event_fd(void)
+{
+    return -1;
+}
+
+static void headless_handle_events(void)
+{
+}
+
+const DisplayBackend headless_backend = {
+    .name = "headless",
+    .open = headless_open,
+    .close = headless_close,
+    .find_connector_mode = headless_find_connector_mode,
+    .create_fb = headless_create_fb,
+    .destroy_fb = headless_destroy_fb,
+    .acquire = headless_acquire,
+    .release = headless_release,
+    .set_crtc = headless_set_crtc,
+    .request_vblank = headless_request_vblank,
+    .event_fd = headless_event_fd,
+    .handle_events = headless_handle_events,
+};
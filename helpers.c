@@ -1,6 +1,10 @@
-#define _POSIX_C_SOURCE 199309L  // For clock_gettime
+#define _POSIX_C_SOURCE 200809L  // For clock_gettime, strnlen
 #include "helpers.h"
+#include "log.h"
+#include "stats.h"
+#include "uring_reader.h"
 #include <ctype.h>
+#include <errno.h>
 #include <png.h>
 #include <stdarg.h>
 #include <stdbool.h>
@@ -12,11 +16,40 @@
 #include <time.h>
 #include <unistd.h> // for getopt/optarg
 
-/* Minimal PNG loader using libpng. Returns malloc'd RGBA (8-bit per channel) buffer. */
-uint8_t *load_png_rgba(const char *path, int *out_w, int *out_h)
+#define PNG_ROW_BATCH 64 // rows decoded between cancellation checks
+#define BLIT_ROW_BATCH 64 // rows blitted between cancellation checks
+
+// libpng read callback fed from the io_uring reader's completed buffers
+static void uring_png_read(png_structp png, png_bytep out, png_size_t len)
 {
-    FILE *fp = fopen(path, "rb");
-    if (!fp)
+    if (uring_reader_read(png_get_io_ptr(png), out, len) != (ssize_t)len)
+        png_error(png, "read error");
+}
+
+static void close_png_input(FILE *fp, UringReader *ur)
+{
+    if (fp)
+        fclose(fp);
+    uring_reader_close(ur);
+}
+
+// Free a partly decoded image and its row pointers, releasing their accounting
+static void free_png_buffers(uint8_t *data, size_t data_bytes, png_bytep *rows, size_t rows_bytes)
+{
+    free(rows);
+    free(data);
+    stats_mem_add(MEM_STAGING, -(int64_t)rows_bytes);
+    stats_mem_add(MEM_IMAGES, -(int64_t)data_bytes);
+}
+
+/* Minimal PNG loader using libpng. Returns malloc'd RGBA (8-bit per channel) buffer.
+   Returns NULL on error or when cancel fires (checked every PNG_ROW_BATCH rows). */
+uint8_t *load_png_rgba(const char *path, int *out_w, int *out_h, const CancelToken *cancel)
+{
+    // io_uring read-ahead when the kernel allows it, plain stdio otherwise
+    FILE *fp = NULL;
+    UringReader *ur = uring_reader_open(path);
+    if (!ur && !(fp = fopen(path, "rb")))
     {
         perror("fopen");
         return NULL;
@@ -24,24 +57,33 @@ uint8_t *load_png_rgba(const char *path, int *out_w, int *out_h)
     png_structp png = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
     if (!png)
     {
-        fclose(fp);
+        close_png_input(fp, ur);
         return NULL;
     }
     png_infop info = png_create_info_struct(png);
     if (!info)
     {
         png_destroy_read_struct(&png, NULL, NULL);
-        fclose(fp);
+        close_png_input(fp, ur);
         return NULL;
     }
+
+    // assigned after setjmp, so volatile: a libpng error while reading rows must free them
+    uint8_t *volatile data = NULL;
+    png_bytep *volatile rows = NULL;
+    volatile size_t data_bytes = 0, rows_bytes = 0;
     if (setjmp(png_jmpbuf(png)))
     {
+        free_png_buffers(data, data_bytes, rows, rows_bytes);
         png_destroy_read_struct(&png, &info, NULL);
-        fclose(fp);
+        close_png_input(fp, ur);
         return NULL;
     }
 
-    png_init_io(png, fp);
+    if (ur)
+        png_set_read_fn(png, ur, uring_png_read);
+    else
+        png_init_io(png, fp);
     png_read_info(png, info);
 
     int width = png_get_image_width(png, info);
@@ -60,25 +102,66 @@ uint8_t *load_png_rgba(const char *path, int *out_w, int *out_h)
 
     png_set_filler(png, 0xFF, PNG_FILLER_AFTER);
     png_set_gray_to_rgb(png);
+    int passes = png_set_interlace_handling(png);
     png_read_update_info(png, info);
 
     png_size_t rowbytes = png_get_rowbytes(png, info);
-    uint8_t *data = malloc(rowbytes * height);
+
+    // the framebuffers and rings stay; cached images can be evicted to make room
+    uint64_t fixed = stats_mem_used(MEM_FRAMEBUFFERS) + stats_mem_used(MEM_RINGS);
+    if (g_mem_budget && (uint64_t)rowbytes * height > (g_mem_budget > fixed ? g_mem_budget - fixed : 0))
+    {
+        ts_fprintf(stderr, "warning: %s is %dx%d, %llu MB decoded: over the -m budget\n", path, width, height,
+                   (unsigned long long)((uint64_t)rowbytes * height >> 20));
+        png_destroy_read_struct(&png, &info, NULL);
+        close_png_input(fp, ur);
+        return NULL;
+    }
+
+    data = malloc(rowbytes * height);
     if (!data)
     {
         png_destroy_read_struct(&png, &info, NULL);
-        fclose(fp);
+        close_png_input(fp, ur);
         return NULL;
     }
+    data_bytes = rowbytes * height;
+    stats_mem_add(MEM_IMAGES, (int64_t)data_bytes);
 
-    png_bytep *rows = malloc(sizeof(png_bytep) * height);
+    rows = malloc(sizeof(png_bytep) * height);
+    if (!rows)
+    {
+        free_png_buffers(data, data_bytes, NULL, 0);
+        png_destroy_read_struct(&png, &info, NULL);
+        close_png_input(fp, ur);
+        return NULL;
+    }
+    rows_bytes = sizeof(png_bytep) * height;
+    stats_mem_add(MEM_STAGING, (int64_t)rows_bytes);
     for (int y = 0; y < height; y++)
         rows[y] = data + y * rowbytes;
-    png_read_image(png, rows);
-    free(rows);
+
+    if (passes > 1)
+        png_read_image(png, rows); // interlaced: every pass touches all rows, no batching
+    else
+    {
+        for (int y = 0; y < height; y += PNG_ROW_BATCH)
+        {
+            if (is_cancelled(cancel))
+            {
+                free_png_buffers(data, data_bytes, rows, rows_bytes);
+                png_destroy_read_struct(&png, &info, NULL);
+                close_png_input(fp, ur);
+                return NULL;
+            }
+            int n = height - y < PNG_ROW_BATCH ? height - y : PNG_ROW_BATCH;
+            png_read_rows(png, rows + y, NULL, n);
+        }
+    }
+    free_png_buffers(NULL, 0, rows, rows_bytes);
 
     png_destroy_read_struct(&png, &info, NULL);
-    fclose(fp);
+    close_png_input(fp, ur);
 
     *out_w = width;
     *out_h = height;
@@ -120,9 +203,82 @@ bool game_has_multiple_screens(const char *romname)
     return multi;
 }
 
-/* Nearest-neighbor scale/blit RGBA -> XRGB8888 framebuffer (dest is uint32_t array) */
-void scale_and_blit_to_xrgb(const uint8_t *src_rgba, int src_w, int src_h, uint32_t *dst, int dst_w, int dst_h,
-                            int dst_stride, int dest_x)
+int pixel_format_bpp(PixelFormat fmt)
+{
+    return fmt == PIX_RGB565 ? 16 : 32;
+}
+
+/* 4x4 Bayer matrix (0..15) for ordered dithering of RGB565 output */
+static const uint8_t bayer4[4][4] = {{0, 8, 2, 10}, {12, 4, 14, 6}, {3, 11, 1, 9}, {15, 7, 13, 5}};
+
+typedef uint16_t u16x8 __attribute__((vector_size(16)));
+
+// Saturating "v + d" clamp to 255 for 8-bit channel values held in 16-bit lanes
+static inline u16x8 clamp255(u16x8 v)
+{
+    u16x8 over = (u16x8)(v > 255);
+    return (v & ~over) | (over & 255);
+}
+
+/* One scaled row RGBA -> RGB565. Eight pixels at a time are gathered into 16-bit vector lanes,
+   dithered and packed with GCC vector extensions (NEON on the Pi 5, SSE2 on x86); the tail is
+   done per pixel. dither_row/dither_x0 anchor the Bayer pattern to screen coordinates. */
+static void blit_row_rgb565(const uint8_t *src_row, int src_w, int scaled_w, uint16_t *dst_row, bool dither,
+                            int dither_row, int dither_x0)
+{
+    u16x8 d_rb = {0}, d_g = {0};
+    if (dither)
+    {
+        // red/blue drop 3 bits (threshold 0..7), green drops 2 bits (threshold 0..3)
+        for (int i = 0; i < 8; ++i)
+        {
+            uint8_t t = bayer4[dither_row & 3][(dither_x0 + i) & 3];
+            d_rb[i] = t >> 1;
+            d_g[i] = t >> 2;
+        }
+    }
+
+    int x = 0;
+    for (; x + 8 <= scaled_w; x += 8)
+    {
+        u16x8 r, g, b;
+        for (int i = 0; i < 8; ++i)
+        {
+            const uint8_t *p = src_row + (size_t)(((x + i) * src_w) / scaled_w) * 4;
+            r[i] = p[0];
+            g[i] = p[1];
+            b[i] = p[2];
+        }
+        if (dither)
+        {
+            r = clamp255(r + d_rb);
+            g = clamp255(g + d_g);
+            b = clamp255(b + d_rb);
+        }
+        u16x8 px = ((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3);
+        memcpy(dst_row + x, &px, sizeof(px));
+    }
+    for (; x < scaled_w; ++x)
+    {
+        const uint8_t *p = src_row + (size_t)((x * src_w) / scaled_w) * 4;
+        unsigned r = p[0], g = p[1], b = p[2];
+        if (dither)
+        {
+            uint8_t t = bayer4[dither_row & 3][(dither_x0 + x) & 3];
+            r = r + (t >> 1) > 255 ? 255 : r + (t >> 1);
+            g = g + (t >> 2) > 255 ? 255 : g + (t >> 2);
+            b = b + (t >> 1) > 255 ? 255 : b + (t >> 1);
+        }
+        dst_row[x] = (uint16_t)(((r >> 3) << 11) | ((g >> 2) << 5) | (b >> 3));
+    }
+}
+
+/* Nearest-neighbor scale/blit RGBA -> framebuffer (dst_stride is in pixels of fmt).
+   For PIX_XRGB8888 every pixel is channel shuffled; for the BGR orders the RGBA word is stored
+   as is, and at 1:1 scale whole rows are memcpy'd. PIX_RGB565 packs (and optionally dithers)
+   8 pixels per vector operation. Stops early (leaving a partial image) when cancel fires. */
+void scale_and_blit_to_xrgb(const uint8_t *src_rgba, int src_w, int src_h, void *dst, int dst_w, int dst_h,
+                            int dst_stride, int dest_x, PixelFormat fmt, bool dither, const CancelToken *cancel)
 {
     if (!src_rgba || !dst)
         return;
@@ -142,6 +298,9 @@ void scale_and_blit_to_xrgb(const uint8_t *src_rgba, int src_w, int src_h, uint3
     int offset_x = dst_x0;
     int offset_y = dst_h - scaled_h;
 
+    uint32_t alpha = fmt == PIX_ABGR8888 ? 0xFF000000u : 0;
+    bool straight = (fmt == PIX_XBGR8888) && scaled_w == src_w && scaled_h == src_h;
+
     for (int y = 0; y < scaled_h; ++y)
     {
         // Skip if rendering outside screen bounds
@@ -149,10 +308,32 @@ void scale_and_blit_to_xrgb(const uint8_t *src_rgba, int src_w, int src_h, uint3
             continue;
         if (offset_y + y >= dst_h)
             break;
-            
+        if (y % BLIT_ROW_BATCH == 0 && is_cancelled(cancel))
+            break;
+
         int src_y = (y * src_h) / scaled_h;
         const uint8_t *src_row = src_rgba + (size_t)src_y * src_w * 4;
-        uint32_t *dst_row = dst + (size_t)(offset_y + y) * dst_stride + offset_x;
+
+        if (fmt == PIX_RGB565)
+        {
+            uint16_t *dst_row = (uint16_t *)dst + (size_t)(offset_y + y) * dst_stride + offset_x;
+            blit_row_rgb565(src_row, src_w, scaled_w, dst_row, dither, offset_y + y, offset_x);
+            continue;
+        }
+
+        uint32_t *dst_row = (uint32_t *)dst + (size_t)(offset_y + y) * dst_stride + offset_x;
+        if (straight)
+        {
+            memcpy(dst_row, src_row, (size_t)scaled_w * 4);
+            continue;
+        }
+        if (fmt != PIX_XRGB8888)
+        {
+            const uint32_t *src_px = (const uint32_t *)src_row;
+            for (int x = 0; x < scaled_w; ++x)
+                dst_row[x] = src_px[(x * src_w) / scaled_w] | alpha;
+            continue;
+        }
         for (int x = 0; x < scaled_w; ++x)
         {
             int src_x = (x * src_w) / scaled_w;
@@ -186,6 +367,103 @@ char *trim(char *s, size_t len)
     return s;
 }
 
+/* Returns true if a kernel uevent datagram ("action@devpath\0KEY=value\0...") is a DRM
+   hotplug change event for the given device name (e.g. "dri/card1"). */
+bool is_drm_hotplug_uevent(const char *msg, size_t len, const char *devname)
+{
+    bool is_drm = false, is_hotplug = false, is_change = false, is_dev = false;
+
+    for (size_t off = 0; off < len;)
+    {
+        const char *kv = msg + off;
+        size_t kvlen = strnlen(kv, len - off);
+
+        off += kvlen + 1;
+        if (off > len)
+            break; // unterminated trailing field
+
+        if (strcmp(kv, "SUBSYSTEM=drm") == 0)
+            is_drm = true;
+        else if (strcmp(kv, "HOTPLUG=1") == 0)
+            is_hotplug = true;
+        else if (strcmp(kv, "ACTION=change") == 0)
+            is_change = true;
+        else if (strncmp(kv, "DEVNAME=", 8) == 0)
+            is_dev = strcmp(kv + 8, devname) == 0;
+    }
+    return is_drm && is_hotplug && is_change && is_dev;
+}
+
+/* Strip an optional "<n>:" output prefix from a trimmed command. Sets *out_target to n,
+   or -1 when the command has no prefix (applies to all outputs). */
+char *split_output_target(char *s, int *out_target)
+{
+    *out_target = -1;
+    if (!s || !isdigit((unsigned char)s[0]))
+        return s;
+
+    char *endptr = NULL;
+    long n = strtol(s, &endptr, 10);
+    if (*endptr != ':' || n < 0 || n >= MAX_OUTPUTS)
+        return s; // not a prefix, e.g. a ROM name starting with a digit
+
+    *out_target = (int)n;
+    char *p = endptr + 1;
+    while (*p && isspace((unsigned char)*p))
+        ++p;
+    return p;
+}
+
+// True for commands that only change what is displayed (ROM shortname, CLEAR); sets the output target
+static bool is_display_command(char *cmd, int *target)
+{
+    CommandType c = toCommandType(split_output_target(cmd, target));
+    return c == CMD_ROM || c == CMD_CLEAR;
+}
+
+/* Latest-wins coalescing of a batch of trimmed commands: a display command (ROM shortname or
+   CLEAR) is superseded when a later display command in the batch targets the same output (or all
+   outputs). Control commands (EXIT, RESET, mode changes, ...) are always kept, in order.
+   Sets superseded[i] for every dropped command; returns how many were dropped. */
+int coalesce_commands(char **cmds, int n, bool *superseded)
+{
+    int dropped = 0;
+    for (int i = 0; i < n; ++i)
+    {
+        int ti = -1;
+        superseded[i] = false;
+        if (is_display_command(cmds[i], &ti))
+        {
+            for (int j = i + 1; j < n && !superseded[i]; ++j)
+            {
+                int tj = -1;
+                superseded[i] = is_display_command(cmds[j], &tj) && (tj == -1 || tj == ti);
+            }
+        }
+        dropped += superseded[i];
+    }
+    return dropped;
+}
+
+FrontendMode g_frontend_mode = eNA;
+const char *g_output_specs[MAX_OUTPUTS];
+int g_num_output_specs = 0;
+int g_fb_bpp = 32;
+bool g_dither = false;
+int g_refresh_hz = 0;
+int g_rt_prio = 0;
+int g_rt_cpu = -1;
+const char *g_metrics_file = NULL;
+int g_headless_w = 0;
+int g_headless_h = 0;
+int g_headless_hz = 60;
+const char *g_frame_dump_dir = NULL;
+bool g_frame_dump_raw = false;
+const char *g_trace_file = NULL;
+const char *g_timeline_file = NULL;
+uint64_t g_mem_budget = (uint64_t)DEFAULT_MEM_BUDGET_MB << 20;
+const char *g_device_path = DEVICE_PATH;
+
 FrontendMode toFrontendMode(const char *s)
 {
     if (!s)
@@ -214,9 +492,8 @@ const char *fromFrontendMode(FrontendMode m)
 
 int parseFrontendModeArg(int argc, char **argv)
 {
-    extern FrontendMode g_frontend_mode;
     int opt;
-    while ((opt = getopt(argc, argv, "f:h")) != -1)
+    while ((opt = getopt(argc, argv, "f:b:Dr:R:M:L:H:d:T:P:m:c:o:h")) != -1)
     {
         switch (opt)
         {
@@ -225,18 +502,131 @@ int parseFrontendModeArg(int argc, char **argv)
             if (g_frontend_mode == eNA && strcmp(optarg, "NA") != 0 && strcmp(optarg, "None") != 0)
             {
                 fprintf(stderr, "error: invalid frontend '%s'\n", optarg);
-                fprintf(stderr, "Usage: %s [-f SA|RA|NA]\n", argv[0]);
+                fprintf(stderr, "Usage: %s " USAGE_ARGS "\n", argv[0]);
+                return 2;
+            }
+            break;
+        case 'b':
+            g_fb_bpp = atoi(optarg);
+            if (g_fb_bpp != 16 && g_fb_bpp != 32)
+            {
+                fprintf(stderr, "error: invalid framebuffer depth '%s'\n", optarg);
+                fprintf(stderr, "Usage: %s " USAGE_ARGS "\n", argv[0]);
+                return 2;
+            }
+            break;
+        case 'D':
+            g_dither = true;
+            break;
+        case 'r':
+            g_refresh_hz = strcmp(optarg, "min") == 0 ? -1 : atoi(optarg);
+            if (g_refresh_hz == 0 || g_refresh_hz < -1)
+            {
+                fprintf(stderr, "error: invalid refresh '%s'\n", optarg);
+                fprintf(stderr, "Usage: %s " USAGE_ARGS "\n", argv[0]);
+                return 2;
+            }
+            break;
+        case 'R':
+        {
+            // PRIO[@CPU]; keep below the kernel's threaded IRQs (50)
+            char *end = NULL;
+            g_rt_prio = (int)strtol(optarg, &end, 10);
+            g_rt_cpu = -1;
+            if (*end == '@' && end[1] >= '0' && end[1] <= '9')
+                g_rt_cpu = (int)strtol(end + 1, &end, 10);
+            if (*end != '\0' || g_rt_prio < 1 || g_rt_prio > 49)
+            {
+                fprintf(stderr, "error: invalid real-time priority '%s' (1-49[@CPU])\n", optarg);
+                fprintf(stderr, "Usage: %s " USAGE_ARGS "\n", argv[0]);
+                return 2;
+            }
+            break;
+        }
+        case 'M':
+            g_metrics_file = optarg;
+            break;
+        case 'L':
+            g_log_level = toLogLevel(optarg);
+            if ((int)g_log_level < 0)
+            {
+                fprintf(stderr, "error: invalid log level '%s' (debug|info|warn|error)\n", optarg);
+                fprintf(stderr, "Usage: %s " USAGE_ARGS "\n", argv[0]);
+                return 2;
+            }
+            break;
+        case 'H':
+        {
+            // WxH[@HZ]
+            char *end = NULL;
+            g_headless_w = (int)strtol(optarg, &end, 10);
+            g_headless_h = *end == 'x' ? (int)strtol(end + 1, &end, 10) : 0;
+            g_headless_hz = 60;
+            if (*end == '@')
+                g_headless_hz = (int)strtol(end + 1, &end, 10);
+            if (*end != '\0' || g_headless_w < 1 || g_headless_w > 8192 || g_headless_h < 1 || g_headless_h > 8192 ||
+                g_headless_hz < 1 || g_headless_hz > 240)
+            {
+                fprintf(stderr, "error: invalid headless mode '%s' (WxH[@HZ])\n", optarg);
+                fprintf(stderr, "Usage: %s " USAGE_ARGS "\n", argv[0]);
+                return 2;
+            }
+            break;
+        }
+        case 'd':
+            g_frame_dump_raw = strncmp(optarg, "raw:", 4) == 0;
+            g_frame_dump_dir = g_frame_dump_raw ? optarg + 4 : optarg;
+            break;
+        case 'T':
+            g_trace_file = optarg;
+            break;
+        case 'P':
+            g_timeline_file = optarg;
+            break;
+        case 'm':
+        {
+            char *end = NULL;
+            long mb = strtol(optarg, &end, 10);
+            if (*end != '\0' || mb < 0 || mb > 65536)
+            {
+                fprintf(stderr, "error: invalid memory budget '%s' (MB, 0 = unlimited)\n", optarg);
+                fprintf(stderr, "Usage: %s " USAGE_ARGS "\n", argv[0]);
+                return 2;
+            }
+            g_mem_budget = (uint64_t)mb << 20;
+            break;
+        }
+        case 'c':
+            // hotplug uevents are matched on the name below /dev/
+            if (strncmp(optarg, "/dev/dri/", strlen("/dev/dri/")) != 0 || !optarg[strlen("/dev/dri/")])
+            {
+                fprintf(stderr, "error: invalid DRM device '%s' (/dev/dri/cardN)\n", optarg);
+                fprintf(stderr, "Usage: %s " USAGE_ARGS "\n", argv[0]);
+                return 2;
+            }
+            g_device_path = optarg;
+            break;
+        case 'o':
+            if (g_num_output_specs >= MAX_OUTPUTS)
+            {
+                fprintf(stderr, "error: at most %d outputs supported\n", MAX_OUTPUTS);
                 return 2;
             }
+            g_output_specs[g_num_output_specs++] = optarg;
             break;
         case 'h':
-            fprintf(stderr, "Usage: %s [-f SA|RA|NA]\n", argv[0]);
+            fprintf(stderr, "Usage: %s " USAGE_ARGS "\n", argv[0]);
             return 0;
         default:
-            fprintf(stderr, "Usage: %s [-f SA|RA|NA]\n", argv[0]);
+            fprintf(stderr, "Usage: %s " USAGE_ARGS "\n", argv[0]);
             return 2;
         }
     }
+    if (g_frame_dump_dir && !g_headless_w)
+    {
+        fprintf(stderr, "error: -d needs a headless display (-H)\n");
+        return 2;
+    }
     return 0;
 }
 
@@ -256,6 +646,14 @@ CommandType toCommandType(const char *s)
         return CMD_NA;
     if (strcmp(s, "RESET") == 0)
         return CMD_RESET;
+    if (strcmp(s, "HOTPLUG") == 0)
+        return CMD_HOTPLUG;
+    if (strcmp(s, "STATS") == 0)
+        return CMD_STATS;
+    if (strcmp(s, "MEM") == 0)
+        return CMD_MEM;
+    if (strncmp(s, "PREFETCH ", strlen("PREFETCH ")) == 0)
+        return CMD_PREFETCH;
     // If not a known command, treat as ROM
     return CMD_ROM;
 }
@@ -272,14 +670,53 @@ const char *fromCommandType(CommandType c)
         return "RA";
     case CMD_SA:
         return "SA";
+    case CMD_NA:
+        return "NA";
     case CMD_RESET:
         return "RESET";
+    case CMD_HOTPLUG:
+        return "HOTPLUG";
+    case CMD_PREFETCH:
+        return "PREFETCH";
+    case CMD_STATS:
+        return "STATS";
+    case CMD_MEM:
+        return "MEM";
     case CMD_ROM:
     default:
         return "ROM";
     }
 }
 
+const char *fromCmdStatus(CmdStatus s)
+{
+    switch (s)
+    {
+    case ST_OK:
+        return "OK";
+    case ST_SHOWN:
+        return "SHOWN";
+    case ST_MISSING:
+        return "MISSING";
+    case ST_FAILED:
+        return "FAILED";
+    case ST_MULTISCREEN:
+        return "SKIPPED_MULTISCREEN";
+    case ST_SUPERSEDED:
+        return "SUPERSEDED";
+    case ST_BAD_OUTPUT:
+    default:
+        return "BAD_OUTPUT";
+    }
+}
+
+uint64_t monotonic_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
 // Get current timestamp in HH:MM:SS.mmm format
 void get_timestamp(char *buffer, size_t size)
 {
@@ -296,37 +733,49 @@ void get_timestamp(char *buffer, size_t size)
 // Timestamped printf wrapper
 void ts_printf(const char *format, ...)
 {
-    char timestamp[16];
-    get_timestamp(timestamp, sizeof(timestamp));
-    printf("%s ", timestamp);
+    va_list args;
+    va_start(args, format);
+    log_vwrite(LOG_INFO, stdout, -1, format, args);
+    va_end(args);
+}
 
+// Timestamped printf wrapper for chatty diagnostics, shown with -L debug
+void ts_debug(const char *format, ...)
+{
     va_list args;
     va_start(args, format);
-    vprintf(format, args);
+    log_vwrite(LOG_DEBUG, stdout, -1, format, args);
     va_end(args);
-    fflush(stdout);
 }
 
-// Timestamped fprintf wrapper
+// Timestamped fprintf wrapper: stderr lines are warnings (errors go through ts_error)
 void ts_fprintf(FILE *stream, const char *format, ...)
 {
-    char timestamp[16];
-    get_timestamp(timestamp, sizeof(timestamp));
-    fprintf(stream, "%s ", timestamp);
+    va_list args;
+    va_start(args, format);
+    log_vwrite(stream == stderr ? LOG_WARN : LOG_INFO, stream, -1, format, args);
+    va_end(args);
+}
+
+// Timestamped error on stderr, kept by every -L level
+void ts_error(const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    log_vwrite(LOG_ERROR, stderr, -1, format, args);
+    va_end(args);
+}
 
+static void log_error_errno(int err, const char *format, ...)
+{
     va_list args;
     va_start(args, format);
-    vfprintf(stream, format, args);
+    log_vwrite(LOG_ERROR, stderr, err, format, args);
     va_end(args);
-    fflush(stream);
 }
 
 // Timestamped perror wrapper
 void ts_perror(const char *s)
 {
-    char timestamp[16];
-    get_timestamp(timestamp, sizeof(timestamp));
-    fprintf(stderr, "%s ", timestamp);
-    perror(s);
-    fflush(stderr);
-}
\ No newline at end of file
+    log_error_errno(errno, "%s", s);
+}
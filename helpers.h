@@ -5,10 +5,15 @@
 #include <ctype.h>
 #include <png.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <time.h>
 
 #define INI_DIR   "/opt/retropie/emulators/mame/ini"
+#define MAX_OUTPUTS 4
+#define DEVICE_PATH "/dev/dri/card1"
+#define DEFAULT_MEM_BUDGET_MB 128       // -m: images, framebuffers and buffers together
+#define USAGE_ARGS "[-f SA|RA|NA] [-b 16|32] [-D] [-r min|HZ] [-R PRIO[@CPU]] [-M TEXTFILE] [-L debug|info|warn|error] [-H WxH[@HZ] [-d [raw:]DIR]] [-T TRACEFILE] [-P TIMELINE.json] [-m MB] [-c /dev/dri/CARD] [-o CONNECTOR[=IMAGEDIR]]..."
 
 // Frontend mode enum and conversion helpers
 typedef enum
@@ -21,8 +26,37 @@ typedef enum
 FrontendMode toFrontendMode(const char *s);
 const char *fromFrontendMode(FrontendMode m);
 
-    // Global frontend mode (defined in dmarquees.c)
+// Option globals, set by parseFrontendModeArg(). Defined in helpers.c so that everything
+// linking the parser (the daemon, the microbenchmark) shares them.
+    // Global frontend mode (defined in helpers.c)
     extern FrontendMode g_frontend_mode;
+// Output specs from repeated -o CONNECTOR[=IMAGEDIR] options (defined in helpers.c)
+extern const char *g_output_specs[MAX_OUTPUTS];
+extern int g_num_output_specs;
+// Requested framebuffer depth (-b 16|32) and ordered dithering for 16 bpp (-D) (defined in helpers.c)
+extern int g_fb_bpp;
+extern bool g_dither;
+// Refresh policy (-r): 0 = first mode (default), -1 = lowest rate, N = closest to N Hz (defined in helpers.c)
+extern int g_refresh_hz;
+// Real-time mode (-R): SCHED_FIFO priority (0 = off) and CPU to pin to (-1 = any) (defined in helpers.c)
+extern int g_rt_prio;
+extern int g_rt_cpu;
+// Prometheus textfile rewritten periodically (-M), NULL = socket only (defined in helpers.c)
+extern const char *g_metrics_file;
+// Headless display (-H WxH[@HZ], 0 = real DRM device) and its frame dumps (-d [raw:]DIR) (defined in helpers.c)
+extern int g_headless_w;
+extern int g_headless_h;
+extern int g_headless_hz;
+extern const char *g_frame_dump_dir;
+extern bool g_frame_dump_raw;
+// Command trace recorded with -T, NULL = off (defined in helpers.c)
+extern const char *g_trace_file;
+// Perfetto / chrome://tracing timeline written with -P, NULL = off (defined in helpers.c)
+extern const char *g_timeline_file;
+// Memory budget (-m MB) in bytes for images, framebuffers and buffers, 0 = unlimited (defined in helpers.c)
+extern uint64_t g_mem_budget;
+// DRM device node (-c), default DEVICE_PATH (defined in helpers.c)
+extern const char *g_device_path;
 // Command type enum and conversion helpers
 typedef enum
 {
@@ -33,29 +67,85 @@ typedef enum
     CMD_SA = 3,
     CMD_NA = 4,
     CMD_RESET = 5,
-    CMD_ROM = 6
+    CMD_ROM = 6,
+    CMD_HOTPLUG = 7,
+    CMD_PREFETCH = 8,   // "PREFETCH <shortname>"
+    CMD_STATS = 9,
+    CMD_MEM = 10
 } CommandType;
 
+#define CMD_TYPE_COUNT (CMD_MEM + 1)
 CommandType toCommandType(const char *s);
 const char *fromCommandType(CommandType c);
 
-uint8_t *load_png_rgba(const char *path, int *out_w, int *out_h);
+// Outcome of a command, reported to control socket clients
+typedef enum
+{
+    ST_OK = 0,          // control command done
+    ST_SHOWN,           // marquee displayed
+    ST_MISSING,         // no image for the ROM, default marquee shown instead
+    ST_FAILED,          // image could not be decoded, default marquee shown instead
+    ST_MULTISCREEN,     // multi-screen game, display left unchanged
+    ST_SUPERSEDED,      // dropped in favour of a newer display command
+    ST_BAD_OUTPUT       // "<n>:" prefix names an output that does not exist
+} CmdStatus;
+
+const char *fromCmdStatus(CmdStatus s);
+
+// Framebuffer pixel layouts the blitter can write (see choose_fb_format() in dmarquees.c)
+typedef enum
+{
+    PIX_XRGB8888 = 0, // 0xXXRRGGBB word: channels shuffled from RGBA
+    PIX_XBGR8888 = 1, // bytes R,G,B,X in memory: same layout as RGBA, copied straight through
+    PIX_ABGR8888 = 2, // bytes R,G,B,A in memory: copied through with alpha forced opaque
+    PIX_RGB565 = 3    // 16-bit 5:6:5, optionally ordered-dithered
+} PixelFormat;
+
+int pixel_format_bpp(PixelFormat fmt);
+
+/* Cancellation token for long running work (decode, blit): checked between row batches.
+   A NULL token means the work cannot be cancelled. */
+typedef struct
+{
+    atomic_bool *cancelled;
+} CancelToken;
+
+static inline bool is_cancelled(const CancelToken *tok)
+{
+    return tok && atomic_load_explicit(tok->cancelled, memory_order_relaxed);
+}
+
+/* Decoded RGBA of a PNG, counted in MEM_IMAGES: the caller subtracts w * h * 4 when freeing it.
+   Images larger than the -m budget left after the framebuffers and rings are refused. */
+uint8_t *load_png_rgba(const char *path, int *out_w, int *out_h, const CancelToken *cancel);
 bool game_has_multiple_screens(const char *romname);
 void scale_and_blit_to_xrgb(const uint8_t *src_rgba, int src_w, int src_h,
-                            uint32_t *dst, int dst_w, int dst_h, int dst_stride,
-                            int dest_x);
+                            void *dst, int dst_w, int dst_h, int dst_stride,
+                            int dest_x, PixelFormat fmt, bool dither, const CancelToken *cancel);
 char *trim(char *s, size_t len);
+char *split_output_target(char *s, int *out_target);
+int coalesce_commands(char **cmds, int n, bool *superseded);
+bool is_drm_hotplug_uevent(const char *msg, size_t len, const char *devname);
 int parseFrontendModeArg(int argc, char **argv);
 
+// Monotonic clock in microseconds (for latency measurements)
+uint64_t monotonic_us(void);
+
 // Get current timestamp in HH:MM:SS format
 void get_timestamp(char *buffer, size_t size);
 
 // Timestamped printf wrapper
 void ts_printf(const char *format, ...);
 
+// Timestamped printf wrapper at debug level (-L debug)
+void ts_debug(const char *format, ...);
+
 // Timestamped fprintf wrapper
 void ts_fprintf(FILE *stream, const char *format, ...);
 
+// Timestamped error on stderr (shown at every -L level)
+void ts_error(const char *format, ...);
+
 // Timestamped perror wrapper
 void ts_perror(const char *s);
 
@@ -0,0 +1,614 @@
+#define _GNU_SOURCE
+#include "log.h"
+#include "stats.h"
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING_ENTRIES 256    // per thread; a full ring drops lines instead of blocking
+#define LOG_ARG_BYTES 232       // binary arguments (or the preformatted line) of one entry
+#define LOG_LINE_MAX 1024
+
+LogLevel g_log_level = LOG_INFO;
+
+/* One recorded line: 256 bytes */
+typedef struct
+{
+    uint64_t ts_ns;         // CLOCK_REALTIME
+    const char *fmt;
+    int32_t err;            // errno for a ": strerror" suffix, -1 for none
+    uint8_t to_stderr;
+    uint8_t preformatted;   // args holds the finished text (arguments didn't fit / unsupported)
+    uint16_t arg_len;
+    char args[LOG_ARG_BYTES];
+} LogEntry;
+
+/* Single-producer (owner thread) / single-consumer (writer) ring */
+typedef struct LogRing
+{
+    _Atomic uint32_t head;  // next entry to fill (owner)
+    _Atomic uint32_t tail;  // next entry to write out (writer)
+    atomic_bool dead;       // owner thread exited: freed by the writer once drained
+    atomic_uint dropped;
+    unsigned dropped_reported;
+    struct LogRing *next;
+    LogEntry entries[LOG_RING_ENTRIES];
+} LogRing;
+
+static pthread_mutex_t rings_lock = PTHREAD_MUTEX_INITIALIZER;
+static LogRing *rings = NULL;
+static pthread_key_t ring_key;
+static __thread LogRing *my_ring = NULL;
+
+static atomic_bool log_active = false;  // writer thread running: record instead of writing
+static atomic_bool writer_waiting = false;
+static atomic_bool writer_stop = false;
+static int wake_fd = -1;
+static pthread_t writer_tid;
+
+/* printf conversion spec, parsed the same way when recording and when formatting */
+typedef enum
+{
+    ARG_NONE,       // %%
+    ARG_INT,
+    ARG_LONG,
+    ARG_LLONG,
+    ARG_SIZE,
+    ARG_INTMAX,
+    ARG_PTRDIFF,
+    ARG_UINT,
+    ARG_ULONG,
+    ARG_ULLONG,
+    ARG_DOUBLE,
+    ARG_LDOUBLE,
+    ARG_STR,
+    ARG_PTR,
+    ARG_BAD         // unsupported (%n, %m, wide strings, ...): the line is preformatted instead
+} ArgType;
+
+typedef struct
+{
+    const char *start;
+    size_t len;
+    int stars;      // '*' width/precision arguments (ints) before the value
+    ArgType type;
+} FmtSpec;
+
+// Parse the conversion spec at p (pointing at '%'); returns the first character after it
+static const char *parse_spec(const char *p, FmtSpec *s)
+{
+    enum { LM_NONE, LM_HH, LM_H, LM_L, LM_LL, LM_Z, LM_J, LM_T, LM_BIGL } lm = LM_NONE;
+
+    s->start = p++;
+    s->stars = 0;
+    while (*p && strchr("-+ #0'", *p))
+        p++;
+    if (*p == '*')
+        s->stars++, p++;
+    else
+        while (isdigit((unsigned char)*p))
+            p++;
+    if (*p == '.')
+    {
+        p++;
+        if (*p == '*')
+            s->stars++, p++;
+        else
+            while (isdigit((unsigned char)*p))
+                p++;
+    }
+
+    if (*p == 'h')
+        lm = *++p == 'h' ? (p++, LM_HH) : LM_H;
+    else if (*p == 'l')
+        lm = *++p == 'l' ? (p++, LM_LL) : LM_L;
+    else if (*p == 'q')
+        lm = LM_LL, p++;
+    else if (*p == 'z')
+        lm = LM_Z, p++;
+    else if (*p == 'j')
+        lm = LM_J, p++;
+    else if (*p == 't')
+        lm = LM_T, p++;
+    else if (*p == 'L')
+        lm = LM_BIGL, p++;
+
+    static const ArgType sint[] = {ARG_INT, ARG_INT, ARG_INT, ARG_LONG, ARG_LLONG, ARG_SIZE, ARG_INTMAX, ARG_PTRDIFF, ARG_BAD};
+    static const ArgType uns[] = {ARG_UINT, ARG_UINT, ARG_UINT, ARG_ULONG, ARG_ULLONG, ARG_SIZE, ARG_INTMAX, ARG_PTRDIFF, ARG_BAD};
+    char conv = *p;
+    if (conv)
+        p++;
+    switch (conv)
+    {
+    case '%':
+        s->type = ARG_NONE;
+        break;
+    case 'd':
+    case 'i':
+        s->type = sint[lm];
+        break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        s->type = uns[lm];
+        break;
+    case 'c':
+        s->type = lm == LM_NONE ? ARG_INT : ARG_BAD;
+        break;
+    case 'e':
+    case 'E':
+    case 'f':
+    case 'F':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        s->type = lm == LM_BIGL ? ARG_LDOUBLE : ARG_DOUBLE;
+        break;
+    case 's':
+        s->type = lm == LM_NONE ? ARG_STR : ARG_BAD;
+        break;
+    case 'p':
+        s->type = ARG_PTR;
+        break;
+    default:
+        s->type = ARG_BAD;
+        break;
+    }
+    s->len = (size_t)(p - s->start);
+    return p;
+}
+
+#define CAPTURE(T)                                                                                                     \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        T v_ = va_arg(ap, T);                                                                                          \
+        if (off + sizeof(T) > LOG_ARG_BYTES)                                                                           \
+            return false;                                                                                              \
+        memcpy(e->args + off, &v_, sizeof(T));                                                                         \
+        off += sizeof(T);                                                                                              \
+    } while (0)
+
+// Copy the arguments of format into e->args in binary form; false if they don't fit
+static bool capture_args(LogEntry *e, const char *format, va_list ap)
+{
+    size_t off = 0;
+    for (const char *p = strchr(format, '%'); p; p = strchr(p, '%'))
+    {
+        FmtSpec s;
+        p = parse_spec(p, &s);
+        for (int i = 0; i < s.stars; ++i)
+            CAPTURE(int);
+
+        switch (s.type)
+        {
+        case ARG_NONE:
+            break;
+        case ARG_INT:
+            CAPTURE(int);
+            break;
+        case ARG_LONG:
+            CAPTURE(long);
+            break;
+        case ARG_LLONG:
+            CAPTURE(long long);
+            break;
+        case ARG_SIZE:
+            CAPTURE(size_t);
+            break;
+        case ARG_INTMAX:
+            CAPTURE(intmax_t);
+            break;
+        case ARG_PTRDIFF:
+            CAPTURE(ptrdiff_t);
+            break;
+        case ARG_UINT:
+            CAPTURE(unsigned int);
+            break;
+        case ARG_ULONG:
+            CAPTURE(unsigned long);
+            break;
+        case ARG_ULLONG:
+            CAPTURE(unsigned long long);
+            break;
+        case ARG_DOUBLE:
+            CAPTURE(double);
+            break;
+        case ARG_LDOUBLE:
+            CAPTURE(long double);
+            break;
+        case ARG_PTR:
+            CAPTURE(void *);
+            break;
+        case ARG_STR:
+        {
+            // strings usually live in the caller's stack frame: copy them
+            const char *str = va_arg(ap, const char *);
+            if (!str)
+                str = "(null)";
+            size_t n = strlen(str) + 1;
+            if (off + n > LOG_ARG_BYTES)
+                return false;
+            memcpy(e->args + off, str, n);
+            off += n;
+            break;
+        }
+        case ARG_BAD:
+        default:
+            return false;
+        }
+    }
+    e->arg_len = (uint16_t)off;
+    return true;
+}
+
+#define RENDER(T)                                                                                                      \
+    do                                                                                                                 \
+    {                                                                                                                  \
+        T v_;                                                                                                          \
+        memcpy(&v_, e->args + off, sizeof(T));                                                                         \
+        off += sizeof(T);                                                                                              \
+        n = s.stars == 0   ? snprintf(out + len, size - len, spec, v_)                                                 \
+            : s.stars == 1 ? snprintf(out + len, size - len, spec, star[0], v_)                                        \
+                           : snprintf(out + len, size - len, spec, star[0], star[1], v_);                              \
+    } while (0)
+
+// Format a recorded entry from its format and binary arguments; returns the length
+static size_t render_entry(const LogEntry *e, char *out, size_t size)
+{
+    if (e->preformatted)
+        return (size_t)snprintf(out, size, "%s", e->args);
+
+    size_t len = 0, off = 0;
+    const char *p = e->fmt;
+    while (*p && len < size - 1)
+    {
+        const char *pct = strchr(p, '%');
+        size_t lit = pct ? (size_t)(pct - p) : strlen(p);
+        if (lit > size - 1 - len)
+            lit = size - 1 - len;
+        memcpy(out + len, p, lit);
+        len += lit;
+        if (!pct)
+            break;
+
+        FmtSpec s;
+        p = parse_spec(pct, &s);
+        char spec[32];
+        if (s.len >= sizeof(spec))
+            break;
+        memcpy(spec, s.start, s.len);
+        spec[s.len] = '\0';
+
+        int star[2] = {0, 0};
+        for (int i = 0; i < s.stars; ++i)
+        {
+            memcpy(&star[i], e->args + off, sizeof(int));
+            off += sizeof(int);
+        }
+
+        int n = 0;
+        switch (s.type)
+        {
+        case ARG_NONE:
+            n = snprintf(out + len, size - len, "%%");
+            break;
+        case ARG_INT:
+            RENDER(int);
+            break;
+        case ARG_LONG:
+            RENDER(long);
+            break;
+        case ARG_LLONG:
+            RENDER(long long);
+            break;
+        case ARG_SIZE:
+            RENDER(size_t);
+            break;
+        case ARG_INTMAX:
+            RENDER(intmax_t);
+            break;
+        case ARG_PTRDIFF:
+            RENDER(ptrdiff_t);
+            break;
+        case ARG_UINT:
+            RENDER(unsigned int);
+            break;
+        case ARG_ULONG:
+            RENDER(unsigned long);
+            break;
+        case ARG_ULLONG:
+            RENDER(unsigned long long);
+            break;
+        case ARG_DOUBLE:
+            RENDER(double);
+            break;
+        case ARG_LDOUBLE:
+            RENDER(long double);
+            break;
+        case ARG_PTR:
+            RENDER(void *);
+            break;
+        case ARG_STR:
+        {
+            const char *str = e->args + off;
+            off += strlen(str) + 1;
+            n = s.stars == 0   ? snprintf(out + len, size - len, spec, str)
+                : s.stars == 1 ? snprintf(out + len, size - len, spec, star[0], str)
+                               : snprintf(out + len, size - len, spec, star[0], star[1], str);
+            break;
+        }
+        case ARG_BAD:
+        default:
+            break;
+        }
+        if (n > 0)
+            len += (size_t)n < size - len ? (size_t)n : size - 1 - len;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+// "HH:MM:SS.mmm " (local time) for a CLOCK_REALTIME timestamp
+static void format_timestamp(uint64_t ts_ns, char *buf, size_t size)
+{
+    // localtime_r only once per second; per thread, as write_sync() runs on any producer
+    static __thread time_t cached_sec = -1;
+    static __thread char cached[16];
+    time_t sec = (time_t)(ts_ns / 1000000000ull);
+    if (sec != cached_sec)
+    {
+        struct tm tm;
+        localtime_r(&sec, &tm);
+        strftime(cached, sizeof(cached), "%H:%M:%S", &tm);
+        cached_sec = sec;
+    }
+    snprintf(buf, size, "%s.%03d ", cached, (int)(ts_ns / 1000000ull % 1000));
+}
+
+static void write_entry(const LogEntry *e)
+{
+    char line[LOG_LINE_MAX];
+    format_timestamp(e->ts_ns, line, sizeof(line));
+    size_t len = strlen(line);
+    len += render_entry(e, line + len, sizeof(line) - len);
+    if (e->err >= 0 && len < sizeof(line))
+        snprintf(line + len, sizeof(line) - len, ": %s\n", strerror(e->err));
+    fputs(line, e->to_stderr ? stderr : stdout);
+}
+
+static void write_sync(FILE *stream, int err, const char *format, va_list ap)
+{
+    struct timespec ts;
+    char stamp[20];
+    clock_gettime(CLOCK_REALTIME, &ts);
+    format_timestamp((uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec, stamp, sizeof(stamp));
+    fputs(stamp, stream);
+    vfprintf(stream, format, ap);
+    if (err >= 0)
+        fprintf(stream, ": %s\n", strerror(err));
+    fflush(stream);
+}
+
+// Owner thread exited: let the writer free its ring after draining it
+static void ring_orphaned(void *arg)
+{
+    atomic_store_explicit(&((LogRing *)arg)->dead, true, memory_order_release);
+}
+
+static LogRing *thread_ring(void)
+{
+    if (my_ring)
+        return my_ring;
+    LogRing *r = calloc(1, sizeof(LogRing));
+    if (!r)
+        return NULL;
+    stats_mem_add(MEM_RINGS, sizeof(LogRing));
+    pthread_mutex_lock(&rings_lock);
+    r->next = rings;
+    rings = r;
+    pthread_mutex_unlock(&rings_lock);
+    pthread_setspecific(ring_key, r);
+    my_ring = r;
+    return r;
+}
+
+void log_vwrite(LogLevel level, FILE *stream, int err, const char *format, va_list ap)
+{
+    if (level < g_log_level)
+        return;
+
+    LogRing *r = NULL;
+    if ((stream == stdout || stream == stderr) && atomic_load_explicit(&log_active, memory_order_acquire))
+        r = thread_ring();
+    if (!r)
+    {
+        write_sync(stream, err, format, ap);
+        return;
+    }
+
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    if (head - atomic_load_explicit(&r->tail, memory_order_acquire) == LOG_RING_ENTRIES)
+    {
+        atomic_fetch_add_explicit(&r->dropped, 1, memory_order_relaxed);
+        return;
+    }
+
+    LogEntry *e = &r->entries[head % LOG_RING_ENTRIES];
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    e->ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    e->fmt = format;
+    e->err = err;
+    e->to_stderr = stream == stderr;
+    e->preformatted = 0;
+
+    va_list copy;
+    va_copy(copy, ap);
+    if (!capture_args(e, format, copy))
+    {
+        if (vsnprintf(e->args, sizeof(e->args), format, ap) >= (int)sizeof(e->args))
+            e->args[sizeof(e->args) - 2] = '\n'; // truncated: keep the line terminated
+        e->preformatted = 1;
+    }
+    va_end(copy);
+
+    // publish, then kick the writer only if it is asleep (same handshake as the command ring)
+    atomic_store_explicit(&r->head, head + 1, memory_order_seq_cst);
+    if (atomic_load_explicit(&writer_waiting, memory_order_seq_cst) && atomic_exchange(&writer_waiting, false))
+    {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0)
+            return;
+    }
+}
+
+static bool ring_pending(const LogRing *r)
+{
+    return atomic_load_explicit(&r->tail, memory_order_relaxed) != atomic_load_explicit(&r->head, memory_order_acquire);
+}
+
+/* Write out every recorded line, merged across threads in timestamp order, and free the rings
+   of exited threads. Returns false if nothing was pending. */
+static bool drain_rings(void)
+{
+    bool wrote = false;
+    pthread_mutex_lock(&rings_lock);
+    for (;;)
+    {
+        LogRing *oldest = NULL;
+        for (LogRing *r = rings; r; r = r->next)
+        {
+            if (ring_pending(r) &&
+                (!oldest || r->entries[r->tail % LOG_RING_ENTRIES].ts_ns <
+                                oldest->entries[oldest->tail % LOG_RING_ENTRIES].ts_ns))
+                oldest = r;
+        }
+        if (!oldest)
+            break;
+        uint32_t tail = atomic_load_explicit(&oldest->tail, memory_order_relaxed);
+        write_entry(&oldest->entries[tail % LOG_RING_ENTRIES]);
+        atomic_store_explicit(&oldest->tail, tail + 1, memory_order_release);
+        wrote = true;
+    }
+
+    for (LogRing **pr = &rings; *pr;)
+    {
+        LogRing *r = *pr;
+        unsigned dropped = atomic_load_explicit(&r->dropped, memory_order_relaxed);
+        if (dropped != r->dropped_reported)
+        {
+            struct timespec ts;
+            char stamp[20];
+            clock_gettime(CLOCK_REALTIME, &ts);
+            format_timestamp((uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec, stamp, sizeof(stamp));
+            fprintf(stderr, "%swarning: %u log line(s) dropped (ring full)\n", stamp, dropped - r->dropped_reported);
+            r->dropped_reported = dropped;
+        }
+        if (atomic_load_explicit(&r->dead, memory_order_acquire) && !ring_pending(r))
+        {
+            *pr = r->next;
+            free(r);
+            stats_mem_add(MEM_RINGS, -(int64_t)sizeof(LogRing));
+        }
+        else
+            pr = &r->next;
+    }
+    pthread_mutex_unlock(&rings_lock);
+
+    if (wrote)
+    {
+        fflush(stdout);
+        fflush(stderr);
+    }
+    return wrote;
+}
+
+static bool any_pending(void)
+{
+    bool pending = false;
+    pthread_mutex_lock(&rings_lock);
+    for (LogRing *r = rings; r && !pending; r = r->next)
+        pending = ring_pending(r);
+    pthread_mutex_unlock(&rings_lock);
+    return pending;
+}
+
+static void *writer_main(void *arg)
+{
+    (void)arg;
+    while (!atomic_load(&writer_stop))
+    {
+        drain_rings();
+        atomic_store_explicit(&writer_waiting, true, memory_order_seq_cst);
+        if (any_pending() || atomic_load(&writer_stop))
+        {
+            atomic_store(&writer_waiting, false);
+            continue;
+        }
+        uint64_t count;
+        if (read(wake_fd, &count, sizeof(count)) < 0 && errno != EINTR)
+            break;
+    }
+    drain_rings();
+    return NULL;
+}
+
+LogLevel toLogLevel(const char *s)
+{
+    static const char *const names[] = {"debug", "info", "warn", "error"};
+    for (int i = 0; i < 4; ++i)
+    {
+        if (s && strcmp(s, names[i]) == 0)
+            return (LogLevel)i;
+    }
+    return (LogLevel)-1;
+}
+
+int log_start(void)
+{
+    if (atomic_load(&log_active))
+        return 0;
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0 || pthread_key_create(&ring_key, ring_orphaned) != 0)
+        return -1;
+
+    // the writer must never take SIGINT/SIGTERM (those are read from a signalfd)
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rc = pthread_create(&writer_tid, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+    {
+        close(wake_fd);
+        wake_fd = -1;
+        return -1;
+    }
+    atomic_store_explicit(&log_active, true, memory_order_release);
+    return 0;
+}
+
+void log_stop(void)
+{
+    if (!atomic_exchange(&log_active, false))
+        return;
+    atomic_store(&writer_stop, true);
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0)
+        return;
+    pthread_join(writer_tid, NULL);
+    close(wake_fd);
+    wake_fd = -1;
+}
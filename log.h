@@ -0,0 +1,34 @@
+#ifndef LOG_H
+#define LOG_H
+#include <stdarg.h>
+#include <stdio.h>
+
+/* Asynchronous logger behind ts_printf()/ts_fprintf()/ts_error()/ts_perror(). A log call
+   records a raw timestamp, the format pointer and the arguments in binary form into the
+   calling thread's ring; a background thread formats, timestamps and writes them. Until log_start() (and after
+   log_stop()) lines are written synchronously. */
+
+typedef enum
+{
+    LOG_DEBUG = 0,
+    LOG_INFO,
+    LOG_WARN,
+    LOG_ERROR
+} LogLevel;
+
+// Lines below this level are dropped at the call site (-L)
+extern LogLevel g_log_level;
+
+LogLevel toLogLevel(const char *s);   // "debug", "info", "warn", "error"; -1 if unknown
+
+// Start the writer thread. Returns 0, or -1 (logging stays synchronous).
+int log_start(void);
+
+// Write out everything recorded, stop the writer thread and go back to synchronous logging
+void log_stop(void);
+
+/* Record one line. err is the errno for a trailing ": strerror(err)" (ts_perror), or -1.
+   format must be a string literal (only its pointer is kept). */
+void log_vwrite(LogLevel level, FILE *stream, int err, const char *format, va_list ap);
+
+#endif
@@ -0,0 +1,229 @@
+#include "stats.h"
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+typedef struct
+{
+    atomic_uint_fast64_t count;
+    atomic_uint_fast64_t sum_us;
+    atomic_uint_fast64_t max_us;
+    atomic_uint_fast64_t buckets[STATS_BUCKETS];
+} StageHist;
+
+static StageHist hists[STAGE_COUNT];
+static atomic_uint_fast64_t cache_hits, cache_misses;
+static atomic_int_fast64_t mem_used[MEM_COUNT];
+static atomic_int_fast64_t mem_total, mem_peak;
+
+static const char *const pool_names[MEM_COUNT] = {"images", "framebuffers", "staging", "rings"};
+
+static const char *const stage_names[STAGE_COUNT] = {
+    "fifo_read", "multiscreen", "stat", "decode", "clear", "blit", "crtc", "scanout",
+};
+
+// values 0..3 map to buckets 0..3; above that, bucket = 4 * (log2(v) - 1) + next two bits of v
+static int bucket_of(uint64_t v)
+{
+    if (v < 4)
+        return (int)v;
+    int e = 63 - __builtin_clzll(v);
+    int b = (e - 1) * 4 + (int)((v >> (e - 2)) & 3);
+    return b < STATS_BUCKETS ? b : STATS_BUCKETS - 1;
+}
+
+uint64_t stats_bucket_limit(int b)
+{
+    if (b < 4)
+        return (uint64_t)b;
+    int e = b / 4 + 1;
+    return ((4ull + (uint64_t)(b & 3) + 1) << (e - 2)) - 1;
+}
+
+void stats_record(Stage s, uint64_t us)
+{
+    StageHist *h = &hists[s];
+    atomic_fetch_add_explicit(&h->count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->sum_us, us, memory_order_relaxed);
+    atomic_fetch_add_explicit(&h->buckets[bucket_of(us)], 1, memory_order_relaxed);
+
+    uint_fast64_t max = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    while (us > max && !atomic_compare_exchange_weak_explicit(&h->max_us, &max, us, memory_order_relaxed,
+                                                              memory_order_relaxed))
+        ;
+}
+
+void stats_mem_add(MemPool p, int64_t bytes)
+{
+    atomic_fetch_add_explicit(&mem_used[p], bytes, memory_order_relaxed);
+    int_fast64_t total = atomic_fetch_add_explicit(&mem_total, bytes, memory_order_relaxed) + bytes;
+    int_fast64_t peak = atomic_load_explicit(&mem_peak, memory_order_relaxed);
+    while (total > peak && !atomic_compare_exchange_weak_explicit(&mem_peak, &peak, total, memory_order_relaxed,
+                                                                  memory_order_relaxed))
+        ;
+}
+
+uint64_t stats_mem_used(MemPool p)
+{
+    int_fast64_t v = atomic_load_explicit(&mem_used[p], memory_order_relaxed);
+    return v > 0 ? (uint64_t)v : 0;
+}
+
+uint64_t stats_mem_total(void)
+{
+    int_fast64_t v = atomic_load_explicit(&mem_total, memory_order_relaxed);
+    return v > 0 ? (uint64_t)v : 0;
+}
+
+void stats_cache_access(bool hit)
+{
+    atomic_fetch_add_explicit(hit ? &cache_hits : &cache_misses, 1, memory_order_relaxed);
+}
+
+void stats_cache_counts(uint64_t *hits, uint64_t *misses)
+{
+    *hits = atomic_load_explicit(&cache_hits, memory_order_relaxed);
+    *misses = atomic_load_explicit(&cache_misses, memory_order_relaxed);
+}
+
+const char *stats_stage_name(Stage s)
+{
+    return stage_names[s];
+}
+
+void stats_snapshot(Stage s, StageSnapshot *out)
+{
+    StageHist *h = &hists[s];
+    out->count = atomic_load_explicit(&h->count, memory_order_relaxed);
+    out->sum_us = atomic_load_explicit(&h->sum_us, memory_order_relaxed);
+    out->max_us = atomic_load_explicit(&h->max_us, memory_order_relaxed);
+    for (int b = 0; b < STATS_BUCKETS; ++b)
+        out->buckets[b] = atomic_load_explicit(&h->buckets[b], memory_order_relaxed);
+}
+
+uint64_t stats_percentile(const StageSnapshot *snap, int p)
+{
+    uint64_t total = 0;
+    for (int b = 0; b < STATS_BUCKETS; ++b)
+        total += snap->buckets[b];
+    if (total == 0)
+        return 0;
+
+    uint64_t rank = (total * (uint64_t)p + 99) / 100, seen = 0;
+    for (int b = 0; b < STATS_BUCKETS; ++b)
+    {
+        seen += snap->buckets[b];
+        if (seen >= rank)
+        {
+            uint64_t limit = stats_bucket_limit(b);
+            return limit < snap->max_us ? limit : snap->max_us;
+        }
+    }
+    return snap->max_us;
+}
+
+int stats_format(char *buf, size_t size)
+{
+    size_t len = 0;
+    for (int s = 0; s < STAGE_COUNT && len < size; ++s)
+    {
+        StageSnapshot snap;
+        stats_snapshot((Stage)s, &snap);
+        len += (size_t)snprintf(buf + len, size - len,
+                                "stage=%s count=%llu p50_us=%llu p95_us=%llu p99_us=%llu max_us=%llu\n",
+                                stage_names[s], (unsigned long long)snap.count,
+                                (unsigned long long)stats_percentile(&snap, 50),
+                                (unsigned long long)stats_percentile(&snap, 95),
+                                (unsigned long long)stats_percentile(&snap, 99), (unsigned long long)snap.max_us);
+    }
+    uint64_t hits, misses;
+    stats_cache_counts(&hits, &misses);
+    if (len < size)
+        len += (size_t)snprintf(buf + len, size - len, "cache hits=%llu misses=%llu", (unsigned long long)hits,
+                                (unsigned long long)misses);
+    return len < size ? (int)len : (int)size - 1;
+}
+
+// Append printf output at buf + *len, never past size
+static void append(char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+    if (*len >= size)
+        return;
+    va_list ap;
+    va_start(ap, fmt);
+    int n = vsnprintf(buf + *len, size - *len, fmt, ap);
+    va_end(ap);
+    *len = n < 0 ? *len : *len + (size_t)n;
+}
+
+int stats_format_prometheus(char *buf, size_t size)
+{
+    size_t len = 0;
+    append(buf, size, &len,
+           "# HELP dmarquees_stage_duration_seconds Latency of each command stage.\n"
+           "# TYPE dmarquees_stage_duration_seconds histogram\n");
+    for (int s = 0; s < STAGE_COUNT; ++s)
+    {
+        StageSnapshot snap;
+        stats_snapshot((Stage)s, &snap);
+
+        /* bucket 4k+3 holds values up to 2^(k+2)-1 us, i.e. "le" 2^(k+2) us in integer microseconds;
+           every other one is exported, 8 us to 33.5 s */
+        uint64_t cumulative = 0;
+        for (int b = 0; b < STATS_BUCKETS; ++b)
+        {
+            cumulative += snap.buckets[b];
+            if (b % 8 == 7 && b <= 95)
+                append(buf, size, &len, "dmarquees_stage_duration_seconds_bucket{stage=\"%s\",le=\"%.6f\"} %llu\n",
+                       stage_names[s], (double)(stats_bucket_limit(b) + 1) / 1e6, (unsigned long long)cumulative);
+        }
+        append(buf, size, &len, "dmarquees_stage_duration_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n",
+               stage_names[s], (unsigned long long)snap.count);
+        append(buf, size, &len, "dmarquees_stage_duration_seconds_sum{stage=\"%s\"} %.6f\n", stage_names[s],
+               (double)snap.sum_us / 1e6);
+        append(buf, size, &len, "dmarquees_stage_duration_seconds_count{stage=\"%s\"} %llu\n", stage_names[s],
+               (unsigned long long)snap.count);
+    }
+
+    uint64_t hits, misses;
+    stats_cache_counts(&hits, &misses);
+    append(buf, size, &len,
+           "# HELP dmarquees_image_cache_lookups_total Decoded image cache lookups.\n"
+           "# TYPE dmarquees_image_cache_lookups_total counter\n"
+           "dmarquees_image_cache_lookups_total{result=\"hit\"} %llu\n"
+           "dmarquees_image_cache_lookups_total{result=\"miss\"} %llu\n",
+           (unsigned long long)hits, (unsigned long long)misses);
+    return len < size ? (int)len : (int)size - 1;
+}
+
+int stats_format_mem(char *buf, size_t size, uint64_t budget)
+{
+    size_t len = 0;
+    if (size)
+        buf[0] = '\0';
+    for (int p = 0; p < MEM_COUNT; ++p)
+        append(buf, size, &len, "pool=%s bytes=%llu\n", pool_names[p], (unsigned long long)stats_mem_used((MemPool)p));
+    append(buf, size, &len, "total bytes=%llu peak_bytes=%llu budget_bytes=%llu", (unsigned long long)stats_mem_total(),
+           (unsigned long long)atomic_load_explicit(&mem_peak, memory_order_relaxed), (unsigned long long)budget);
+    return len < size ? (int)len : (int)size - 1;
+}
+
+int stats_format_mem_prometheus(char *buf, size_t size, uint64_t budget)
+{
+    size_t len = 0;
+    append(buf, size, &len,
+           "# HELP dmarquees_memory_bytes Memory held by the daemon's buffers, by pool.\n"
+           "# TYPE dmarquees_memory_bytes gauge\n");
+    for (int p = 0; p < MEM_COUNT; ++p)
+        append(buf, size, &len, "dmarquees_memory_bytes{pool=\"%s\"} %llu\n", pool_names[p],
+               (unsigned long long)stats_mem_used((MemPool)p));
+    append(buf, size, &len,
+           "# HELP dmarquees_memory_peak_bytes Highest total of dmarquees_memory_bytes.\n"
+           "# TYPE dmarquees_memory_peak_bytes gauge\n"
+           "dmarquees_memory_peak_bytes %llu\n"
+           "# HELP dmarquees_memory_budget_bytes Budget set with -m (0 = unlimited).\n"
+           "# TYPE dmarquees_memory_budget_bytes gauge\n"
+           "dmarquees_memory_budget_bytes %llu\n",
+           (unsigned long long)atomic_load_explicit(&mem_peak, memory_order_relaxed), (unsigned long long)budget);
+    return len < size ? (int)len : (int)size - 1;
+}
@@ -0,0 +1,76 @@
+#ifndef STATS_H
+#define STATS_H
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Per-stage latency histograms. Recording is lock-free (relaxed atomics) and safe from any
+   thread; buckets are log2 with 4 linear steps each, so percentiles are within 25%. */
+typedef enum
+{
+    STAGE_FIFO_READ,    // draining the command FIFO
+    STAGE_MULTISCREEN,  // game_has_multiple_screens()
+    STAGE_STAT,         // stat() of the marquee files
+    STAGE_DECODE,       // load_png_rgba() (cache misses only)
+    STAGE_CLEAR,        // clearing a framebuffer before the blit
+    STAGE_BLIT,         // scale_and_blit_to_xrgb()
+    STAGE_CRTC,         // try_reset_crtc()
+    STAGE_SCANOUT,      // command receipt to the first vblank scanning out its frame
+    STAGE_COUNT
+} Stage;
+
+#define STATS_BUCKETS 168   // covers up to 2^42 us
+#define STATS_TEXT_MAX 2048 // STATS reply body
+
+typedef struct
+{
+    uint64_t count;
+    uint64_t sum_us;
+    uint64_t max_us;
+    uint64_t buckets[STATS_BUCKETS];
+} StageSnapshot;
+
+void stats_record(Stage s, uint64_t us);
+
+/* Memory accounting: bytes held by the daemon's buffers, by pool */
+typedef enum
+{
+    MEM_IMAGES,         // decoded RGBA images (shown, cached or being decoded)
+    MEM_FRAMEBUFFERS,   // dumb buffers (bo_size)
+    MEM_STAGING,        // PNG row pointers and io_uring read-ahead buffers
+    MEM_RINGS,          // log, timeline (-P) and command rings
+    MEM_COUNT
+} MemPool;
+
+void stats_mem_add(MemPool p, int64_t bytes);   // negative when released
+uint64_t stats_mem_used(MemPool p);
+uint64_t stats_mem_total(void);
+
+void stats_cache_access(bool hit);
+void stats_cache_counts(uint64_t *hits, uint64_t *misses);
+
+const char *stats_stage_name(Stage s);
+
+// Copy of a stage's histogram (counters read individually, so only approximately consistent)
+void stats_snapshot(Stage s, StageSnapshot *out);
+
+// Upper bound (us) of the bucket holding the p-th percentile, capped at the maximum seen
+uint64_t stats_percentile(const StageSnapshot *snap, int p);
+
+// Upper bound (us) of bucket b
+uint64_t stats_bucket_limit(int b);
+
+// One line per stage with count/p50/p95/p99/max and a cache line; returns the length
+int stats_format(char *buf, size_t size);
+
+/* One line per pool and a total line with the peak and budget (0 = none); returns the length */
+int stats_format_mem(char *buf, size_t size, uint64_t budget);
+
+/* Stage histograms (dmarquees_stage_duration_seconds, buckets at powers of 4 us) and cache
+   hit/miss counters in Prometheus text format; returns the length */
+int stats_format_prometheus(char *buf, size_t size);
+
+// Memory pools, peak and budget in Prometheus text format; returns the length
+int stats_format_mem_prometheus(char *buf, size_t size, uint64_t budget);
+
+#endif
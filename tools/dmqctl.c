@@ -0,0 +1,47 @@
+/*
+ dmqctl - command-line client for dmarquees (libdmarquees)
+
+ Usage:
+   dmqctl show <shortname>      show a ROM marquee
+   dmqctl mode RA|SA|NA         switch the frontend mode
+   dmqctl clear                 show the default marquee
+   dmqctl prefetch <shortname>  decode a marquee into the daemon's cache
+   dmqctl <command>             send any raw command (e.g. "1:sf", RESET, HOTPLUG)
+
+ Prints the daemon's reply; exits 1 if the daemon could not be reached.
+*/
+
+#include "dmq_client.h"
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char **argv)
+{
+    char cmd[256];
+    char reply[DMQ_REPLY_MAX];
+
+    if (argc == 3 && strcmp(argv[1], "show") == 0)
+        snprintf(cmd, sizeof(cmd), "%s", argv[2]);
+    else if (argc == 3 && strcmp(argv[1], "mode") == 0)
+        snprintf(cmd, sizeof(cmd), "%s", argv[2]);
+    else if (argc == 2 && strcmp(argv[1], "clear") == 0)
+        snprintf(cmd, sizeof(cmd), "CLEAR");
+    else if (argc == 3 && strcmp(argv[1], "prefetch") == 0)
+        snprintf(cmd, sizeof(cmd), "PREFETCH %s", argv[2]);
+    else if (argc == 2 && strcmp(argv[1], "-h") != 0)
+        snprintf(cmd, sizeof(cmd), "%s", argv[1]);
+    else
+    {
+        fprintf(stderr, "Usage: %s show ROM | mode RA|SA|NA | clear | prefetch ROM | COMMAND\n", argv[0]);
+        return 2;
+    }
+
+    if (dmq_command(cmd, reply, sizeof(reply)) == DMQ_ERROR)
+    {
+        fprintf(stderr, "dmqctl: no reply from dmarquees (is it running?)\n");
+        return 1;
+    }
+    printf("%s\n", reply);
+    dmq_close();
+    return 0;
+}
@@ -0,0 +1,303 @@
+/*
+ dmqreplay - replay a command trace recorded with "dmarquees -T FILE"
+
+ Usage: dmqreplay [-s SPEED|max] [-f] TRACEFILE
+   Sends the trace's commands to the control socket at their recorded times (-s 1, default),
+   SPEED times faster (-s 4, -s 0.5) or back to back (-s max). Sending does not wait for
+   replies, so attract-mode bursts and rapid browsing reach the daemon as they did on the
+   cabinet. Replies are matched to their commands for the end-to-end latency; prints the
+   p50/p90/p99/max latency, the throughput and the number of replies per status.
+   -f writes to the command FIFO instead: no replies, only the pace and throughput are reported.
+*/
+
+#define _GNU_SOURCE
+#include "dmq_client.h"
+#include "dmq_ring.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#define DRAIN_TIMEOUT_MS 10000           // wait this long for outstanding replies at the end
+#define MAX_STATUSES 16
+
+typedef struct
+{
+    uint64_t at_us;     // offset in the trace
+    char cmd[DMQ_RING_CMD_LEN];
+    uint64_t sent_us;   // 0 = not sent yet
+    bool answered;
+} TraceEntry;
+
+static TraceEntry *entries = NULL;
+static int num_entries = 0;
+
+static char statuses[MAX_STATUSES][32];
+static int status_counts[MAX_STATUSES];
+static uint64_t *latencies = NULL;
+static int num_latencies = 0;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+// nearest-rank percentile of a sorted sample
+static uint64_t percentile(const uint64_t *v, int n, int p)
+{
+    int rank = (p * n + 99) / 100;
+    return v[rank > 0 ? rank - 1 : 0];
+}
+
+// "<us> <source> <command>" lines; '#' lines are comments
+static int load_trace(const char *path)
+{
+    FILE *fp = fopen(path, "r");
+    if (!fp)
+    {
+        perror(path);
+        return -1;
+    }
+    char line[DMQ_RING_CMD_LEN + 64];
+    int cap = 0;
+    while (fgets(line, sizeof(line), fp))
+    {
+        unsigned long long at;
+        int cmd_off = 0;
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '#' || sscanf(line, "%llu %*s %n", &at, &cmd_off) != 1 || !cmd_off || !line[cmd_off])
+            continue;
+        if (num_entries == cap)
+        {
+            cap = cap ? cap * 2 : 256;
+            TraceEntry *grown = realloc(entries, (size_t)cap * sizeof(TraceEntry));
+            if (!grown)
+            {
+                fclose(fp);
+                return -1;
+            }
+            entries = grown;
+        }
+        TraceEntry *e = &entries[num_entries++];
+        memset(e, 0, sizeof(*e));
+        e->at_us = at;
+        snprintf(e->cmd, sizeof(e->cmd), "%s", line + cmd_off);
+    }
+    fclose(fp);
+    return num_entries;
+}
+
+static void count_status(const char *status)
+{
+    for (int i = 0; i < MAX_STATUSES; ++i)
+    {
+        if (!statuses[i][0])
+            snprintf(statuses[i], sizeof(statuses[i]), "%.31s", status);
+        if (strcmp(statuses[i], status) == 0)
+        {
+            status_counts[i]++;
+            return;
+        }
+    }
+}
+
+/* Reply "<STATUS> <command> total_us=...": the oldest unanswered send of that command gets it
+   (replies of coalesced commands can overtake older ones) */
+static void match_reply(char *reply, uint64_t now)
+{
+    char *sp = strchr(reply, ' ');
+    char *tail = strstr(reply, " total_us=");
+    if (!sp || !tail || tail < sp)
+        return;
+    *sp = '\0';
+    *tail = '\0';
+    const char *cmd = sp + 1;
+
+    TraceEntry *match = NULL;
+    for (int i = 0; i < num_entries && entries[i].sent_us; ++i)
+    {
+        if (entries[i].answered)
+            continue;
+        if (strcmp(entries[i].cmd, cmd) == 0)
+        {
+            match = &entries[i];
+            break;
+        }
+        if (!match)
+            match = &entries[i];    // fallback: oldest outstanding
+    }
+    if (!match)
+        return;
+    match->answered = true;
+    latencies[num_latencies++] = now - match->sent_us;
+    count_status(reply);
+}
+
+// Read every reply that has arrived; wait up to timeout_ms for the first one
+static void read_replies(int fd, int timeout_ms)
+{
+    struct pollfd pfd = {.fd = fd, .events = POLLIN};
+    if (poll(&pfd, 1, timeout_ms) <= 0)
+        return;
+    char reply[4096];
+    ssize_t n;
+    while ((n = recv(fd, reply, sizeof(reply) - 1, MSG_DONTWAIT)) > 0)
+    {
+        reply[n] = '\0';
+        reply[strcspn(reply, "\n")] = '\0'; // STATS bodies follow the status line
+        match_reply(reply, now_us());
+    }
+}
+
+static int open_target(bool fifo)
+{
+    if (fifo)
+        return open(DMQ_FIFO, O_WRONLY | O_CLOEXEC);
+
+    int fd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -1;
+    struct sockaddr_un addr = {0};
+    addr.sun_family = AF_UNIX;
+    strncpy(addr.sun_path, DMQ_SOCK, sizeof(addr.sun_path) - 1);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int main(int argc, char **argv)
+{
+    double speed = 1.0;     // 0 = as fast as possible
+    bool fifo = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:fh")) != -1)
+    {
+        if (opt == 's' && strcmp(optarg, "max") == 0)
+            speed = 0;
+        else if (opt == 's' && atof(optarg) > 0)
+            speed = atof(optarg);
+        else if (opt == 'f')
+            fifo = true;
+        else
+        {
+            fprintf(stderr, "Usage: %s [-s SPEED|max] [-f] TRACEFILE\n", argv[0]);
+            return 2;
+        }
+    }
+    if (optind != argc - 1)
+    {
+        fprintf(stderr, "Usage: %s [-s SPEED|max] [-f] TRACEFILE\n", argv[0]);
+        return 2;
+    }
+    if (load_trace(argv[optind]) <= 0)
+    {
+        fprintf(stderr, "dmqreplay: no commands in %s\n", argv[optind]);
+        return 1;
+    }
+    latencies = calloc((size_t)num_entries, sizeof(uint64_t));
+    int fd = open_target(fifo);
+    if (!latencies || fd < 0)
+    {
+        fprintf(stderr, "dmqreplay: cannot reach dmarquees (%s)\n", fifo ? DMQ_FIFO : DMQ_SOCK);
+        return 1;
+    }
+
+    int errors = 0;
+    uint64_t start = now_us();
+    uint64_t first_at = entries[0].at_us;
+    for (int i = 0; i < num_entries; ++i)
+    {
+        TraceEntry *e = &entries[i];
+        uint64_t due = start + (speed > 0 ? (uint64_t)((e->at_us - first_at) / speed) : 0);
+        for (uint64_t now = now_us(); now < due; now = now_us())
+        {
+            int wait_ms = (int)((due - now + 999) / 1000);
+            if (fifo)
+                usleep((useconds_t)(due - now));
+            else
+                read_replies(fd, wait_ms);
+        }
+
+        e->sent_us = now_us();
+        ssize_t n;
+        if (fifo)
+        {
+            char line[DMQ_RING_CMD_LEN + 1];
+            int len = snprintf(line, sizeof(line), "%s\n", e->cmd);
+            n = write(fd, line, (size_t)len);
+        }
+        else
+            n = send(fd, e->cmd, strlen(e->cmd), MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            perror("dmqreplay: send");
+            errors++;
+            e->answered = true;
+        }
+        if (!fifo)
+            read_replies(fd, 0);
+    }
+    uint64_t sent_end = now_us();
+
+    // collect the outstanding replies
+    for (uint64_t last = now_us(); !fifo && num_latencies + errors < num_entries;)
+    {
+        int before = num_latencies;
+        read_replies(fd, 100);
+        if (num_latencies != before)
+            last = now_us();
+        else if (now_us() - last > DRAIN_TIMEOUT_MS * 1000ull)
+            break;
+    }
+    uint64_t end = now_us();
+    close(fd);
+
+    double trace_s = (entries[num_entries - 1].at_us - first_at) / 1e6;
+    printf("commands=%d trace_s=%.3f replay_s=%.3f send_rate=%.1f/s", num_entries, trace_s,
+           (sent_end - start) / 1e6, sent_end > start ? num_entries * 1e6 / (sent_end - start) : 0.0);
+    if (fifo)
+    {
+        printf(" errors=%d\n", errors);
+        return errors ? 1 : 0;
+    }
+
+    int lost = num_entries - num_latencies - errors;
+    printf(" replies=%d lost=%d errors=%d throughput=%.1f/s", num_latencies, lost, errors,
+           end > start ? num_latencies * 1e6 / (end - start) : 0.0);
+    if (num_latencies)
+    {
+        qsort(latencies, (size_t)num_latencies, sizeof(uint64_t), cmp_u64);
+        printf(" p50_us=%llu p90_us=%llu p99_us=%llu max_us=%llu",
+               (unsigned long long)percentile(latencies, num_latencies, 50),
+               (unsigned long long)percentile(latencies, num_latencies, 90),
+               (unsigned long long)percentile(latencies, num_latencies, 99),
+               (unsigned long long)latencies[num_latencies - 1]);
+    }
+    printf("\n");
+    for (int i = 0; i < MAX_STATUSES && statuses[i][0]; ++i)
+        printf("%s%s=%d", i ? " " : "", statuses[i], status_counts[i]);
+    if (statuses[0][0])
+        printf("\n");
+    free(latencies);
+    free(entries);
+    return errors || lost ? 1 : 0;
+}
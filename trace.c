@@ -0,0 +1,249 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include "helpers.h"
+#include "stats.h"
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define TRACE_SLOTS 4096        // power of two; ~0.6 MB, allocated only with -P
+#define TRACE_FLUSH_MSEC 250
+#define TRACE_NAME_LEN 48
+#define TRACE_ARG_LEN 96
+
+typedef struct
+{
+    _Atomic uint32_t seq;       // == position: free, position + 1: filled (as in dmq_ring.c)
+    char ph;                    // 'X' span, 'A' async span (b/e pair), 'i' instant, 'M' thread name
+    int32_t tid;
+    const char *cat;
+    uint64_t ts_us;
+    uint64_t dur_us;
+    uint64_t id;
+    char name[TRACE_NAME_LEN];
+    char arg[TRACE_ARG_LEN];
+} TraceSlot;
+
+atomic_bool trace_active = false;
+
+static TraceSlot *slots = NULL;
+static _Atomic uint32_t head;
+static uint32_t tail;           // writer thread only
+static atomic_uint dropped;
+static FILE *trace_fp = NULL;
+static bool first_event = true;
+static pthread_t writer_tid;
+static pthread_mutex_t writer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t writer_cond = PTHREAD_COND_INITIALIZER;
+static bool writer_stop = false;
+
+static __thread int32_t my_tid = 0;
+
+static void push(char ph, const char *cat, const char *name, uint64_t ts_us, uint64_t dur_us, uint64_t id,
+                 const char *arg)
+{
+    if (!my_tid)
+        my_tid = (int32_t)syscall(SYS_gettid);
+
+    // claim a slot (multi-producer); a full ring drops the event
+    uint32_t pos = atomic_load_explicit(&head, memory_order_relaxed);
+    TraceSlot *s;
+    for (;;)
+    {
+        s = &slots[pos & (TRACE_SLOTS - 1)];
+        int32_t diff = (int32_t)(atomic_load_explicit(&s->seq, memory_order_acquire) - pos);
+        if (diff == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&head, &pos, pos + 1, memory_order_relaxed,
+                                                      memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+        {
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        }
+        else
+            pos = atomic_load_explicit(&head, memory_order_relaxed);
+    }
+
+    s->ph = ph;
+    s->tid = my_tid;
+    s->cat = cat;
+    s->ts_us = ts_us;
+    s->dur_us = dur_us;
+    s->id = id;
+    snprintf(s->name, sizeof(s->name), "%s", name);
+    snprintf(s->arg, sizeof(s->arg), "%s", arg ? arg : "");
+    atomic_store_explicit(&s->seq, pos + 1, memory_order_release);
+}
+
+void trace_span(const char *cat, const char *name, uint64_t start_us, uint64_t end_us, const char *arg)
+{
+    if (tracing())
+        push('X', cat, name, start_us, end_us - start_us, 0, arg);
+}
+
+void trace_async(const char *cat, const char *name, uint64_t id, uint64_t start_us, uint64_t end_us, const char *arg)
+{
+    if (tracing())
+        push('A', cat, name, start_us, end_us - start_us, id, arg);
+}
+
+void trace_instant(const char *cat, const char *name, const char *arg)
+{
+    if (tracing())
+        push('i', cat, name, monotonic_us(), 0, 0, arg);
+}
+
+void trace_thread_name(const char *name)
+{
+    if (tracing())
+        push('M', "__metadata", name, 0, 0, 0, NULL);
+}
+
+// JSON string body (quotes, backslashes and control characters escaped)
+static void put_json_string(const char *s)
+{
+    for (; *s; ++s)
+    {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\')
+            fprintf(trace_fp, "\\%c", c);
+        else if (c < 0x20)
+            fprintf(trace_fp, "\\u%04x", c);
+        else
+            fputc(c, trace_fp);
+    }
+}
+
+static void write_event(const TraceSlot *s, char ph, uint64_t ts_us)
+{
+    pid_t pid = getpid();
+    fprintf(trace_fp, "%s{\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"name\":\"", first_event ? "" : ",\n", ph, (int)pid,
+            (int)s->tid);
+    first_event = false;
+    if (ph == 'M')
+    {
+        fprintf(trace_fp, "thread_name\",\"args\":{\"name\":\"");
+        put_json_string(s->name);
+        fprintf(trace_fp, "\"}}");
+        return;
+    }
+    put_json_string(s->name);
+    fprintf(trace_fp, "\",\"cat\":\"%s\",\"ts\":%llu", s->cat, (unsigned long long)ts_us);
+    if (ph == 'X')
+        fprintf(trace_fp, ",\"dur\":%llu", (unsigned long long)s->dur_us);
+    else if (ph == 'b' || ph == 'e')
+        fprintf(trace_fp, ",\"id\":\"0x%llx\"", (unsigned long long)s->id);
+    else if (ph == 'i')
+        fprintf(trace_fp, ",\"s\":\"t\"");
+    if (s->arg[0])
+    {
+        fprintf(trace_fp, ",\"args\":{\"detail\":\"");
+        put_json_string(s->arg);
+        fprintf(trace_fp, "\"}");
+    }
+    fputc('}', trace_fp);
+}
+
+static void drain(void)
+{
+    bool wrote = false;
+    for (;;)
+    {
+        TraceSlot *s = &slots[tail & (TRACE_SLOTS - 1)];
+        if (atomic_load_explicit(&s->seq, memory_order_acquire) != tail + 1)
+            break;
+        if (s->ph == 'A')
+        {
+            write_event(s, 'b', s->ts_us);
+            write_event(s, 'e', s->ts_us + s->dur_us);
+        }
+        else
+            write_event(s, s->ph, s->ts_us);
+        atomic_store_explicit(&s->seq, tail + TRACE_SLOTS, memory_order_release);
+        tail++;
+        wrote = true;
+    }
+    if (wrote)
+        fflush(trace_fp);
+}
+
+static void *writer_main(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&writer_lock);
+    while (!writer_stop)
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += TRACE_FLUSH_MSEC * 1000000L;
+        ts.tv_sec += ts.tv_nsec / 1000000000L;
+        ts.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&writer_cond, &writer_lock, &ts);
+        pthread_mutex_unlock(&writer_lock);
+        drain();
+        pthread_mutex_lock(&writer_lock);
+    }
+    pthread_mutex_unlock(&writer_lock);
+    drain();
+    return NULL;
+}
+
+int trace_open(const char *path)
+{
+    slots = calloc(TRACE_SLOTS, sizeof(TraceSlot));
+    trace_fp = slots ? fopen(path, "w") : NULL;
+    if (!trace_fp)
+    {
+        free(slots);
+        slots = NULL;
+        return -1;
+    }
+    for (uint32_t i = 0; i < TRACE_SLOTS; ++i)
+        atomic_init(&slots[i].seq, i);
+    stats_mem_add(MEM_RINGS, TRACE_SLOTS * sizeof(TraceSlot));
+    fprintf(trace_fp, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+
+    // keep SIGINT/SIGTERM for the main thread's signalfd
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int rc = pthread_create(&writer_tid, NULL, writer_main, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (rc != 0)
+    {
+        fclose(trace_fp);
+        trace_fp = NULL;
+        free(slots);
+        slots = NULL;
+        return -1;
+    }
+    atomic_store(&trace_active, true);
+    return 0;
+}
+
+void trace_close(void)
+{
+    if (!atomic_exchange(&trace_active, false))
+        return;
+    pthread_mutex_lock(&writer_lock);
+    writer_stop = true;
+    pthread_cond_signal(&writer_cond);
+    pthread_mutex_unlock(&writer_lock);
+    pthread_join(writer_tid, NULL);
+
+    fprintf(trace_fp, "\n]}\n");
+    fclose(trace_fp);
+    trace_fp = NULL;
+    unsigned lost = atomic_load(&dropped);
+    if (lost)
+        ts_fprintf(stderr, "warning: %u trace event(s) dropped (ring full)\n", lost);
+    // producers that raced with the shutdown may still hold a slot: leave the ring allocated
+}
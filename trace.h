@@ -0,0 +1,39 @@
+#ifndef TRACE_H
+#define TRACE_H
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Timeline of daemon activity in the Chrome trace event JSON format (-P FILE), loadable in
+   Perfetto (ui.perfetto.dev) or chrome://tracing. Events are appended from any thread to a
+   lock-free in-memory ring (a few atomics and a copy, no syscall); a background thread writes
+   them out every TRACE_FLUSH_MSEC. Times are monotonic_us(). When the ring is full events are
+   dropped, never waited for. */
+
+extern atomic_bool trace_active;
+
+static inline bool tracing(void)
+{
+    return atomic_load_explicit(&trace_active, memory_order_relaxed);
+}
+
+// Create the trace file and start the writer thread. Returns 0 or -1.
+int trace_open(const char *path);
+
+// Write out the remaining events, terminate the JSON and stop the writer
+void trace_close(void);
+
+/* Name the calling thread in the timeline */
+void trace_thread_name(const char *name);
+
+/* A span on the calling thread; cat must be a string literal, name and arg (may be NULL) are
+   copied. Spans of one thread must nest. */
+void trace_span(const char *cat, const char *name, uint64_t start_us, uint64_t end_us, const char *arg);
+
+/* A span that may overlap others (a command from receipt to reply), shown on its own track */
+void trace_async(const char *cat, const char *name, uint64_t id, uint64_t start_us, uint64_t end_us, const char *arg);
+
+// A point event on the calling thread (cache hit, eviction, ...)
+void trace_instant(const char *cat, const char *name, const char *arg);
+
+#endif
@@ -0,0 +1,336 @@
+#define _GNU_SOURCE
+#include "uring_reader.h"
+#include "stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define UR_CHUNK (256 << 10)    // bytes per read
+#define UR_DEPTH 4              // reads kept in flight (ring entries)
+#define UR_POOL 4               // idle rings kept for reuse (one per concurrent decode)
+
+/* One read buffer; chunk k of the file lives in slot k % UR_DEPTH */
+typedef struct
+{
+    uint8_t *buf;
+    off_t off;          // file offset of buf[0]
+    size_t len;         // bytes requested for this chunk
+    size_t filled;      // bytes completed so far (short reads are resubmitted)
+    bool inflight;
+    int err;
+} UrSlot;
+
+struct UringReader
+{
+    int ring_fd;
+    int fd;
+    off_t size;
+    off_t next_off;     // next chunk to submit
+
+    /* mmapped rings */
+    void *sq_ptr, *cq_ptr;
+    size_t sq_map_len, cq_map_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    _Atomic unsigned *sq_head, *sq_tail, *cq_head, *cq_tail;
+    unsigned *sq_mask, *sq_array, *cq_mask;
+    struct io_uring_cqe *cqes;
+
+    UrSlot slots[UR_DEPTH];
+    int cur;            // slot being consumed
+    size_t pos;         // consumed bytes of the current slot
+    int inflight;
+    bool broken;        // an SQE may be queued but unaccounted: never pool this ring
+};
+
+/* Rings and their chunk buffers outlive the file: decode threads come and go with each
+   command, so idle readers are parked here instead of paying io_uring_setup, the ring mmaps
+   and 1 MB of buffers for every PNG. */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static UringReader *pool[UR_POOL];
+static int pool_len;
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int map_rings(UringReader *r, const struct io_uring_params *p)
+{
+    r->sq_map_len = p->sq_off.array + p->sq_entries * sizeof(unsigned);
+    r->cq_map_len = p->cq_off.cqes + p->cq_entries * sizeof(struct io_uring_cqe);
+    if (p->features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_map_len > r->sq_map_len)
+            r->sq_map_len = r->cq_map_len;
+        r->cq_map_len = 0;
+    }
+
+    r->sq_ptr = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd,
+                     IORING_OFF_SQ_RING);
+    if (r->sq_ptr == MAP_FAILED)
+        return -1;
+    r->cq_ptr = r->sq_ptr;
+    if (r->cq_map_len)
+    {
+        r->cq_ptr = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd,
+                         IORING_OFF_CQ_RING);
+        if (r->cq_ptr == MAP_FAILED)
+            return -1;
+    }
+    r->sqes_len = p->sq_entries * sizeof(struct io_uring_sqe);
+    r->sqes = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, r->ring_fd,
+                   IORING_OFF_SQES);
+    if (r->sqes == MAP_FAILED)
+        return -1;
+
+    uint8_t *sq = r->sq_ptr, *cq = r->cq_ptr;
+    r->sq_head = (_Atomic unsigned *)(sq + p->sq_off.head);
+    r->sq_tail = (_Atomic unsigned *)(sq + p->sq_off.tail);
+    r->sq_mask = (unsigned *)(sq + p->sq_off.ring_mask);
+    r->sq_array = (unsigned *)(sq + p->sq_off.array);
+    r->cq_head = (_Atomic unsigned *)(cq + p->cq_off.head);
+    r->cq_tail = (_Atomic unsigned *)(cq + p->cq_off.tail);
+    r->cq_mask = (unsigned *)(cq + p->cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)(cq + p->cq_off.cqes);
+    return 0;
+}
+
+// Queue a read of the unfilled part of slot s and submit it
+static int submit_slot(UringReader *r, int s)
+{
+    UrSlot *slot = &r->slots[s];
+    unsigned tail = atomic_load_explicit(r->sq_tail, memory_order_relaxed);
+    unsigned idx = tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_READ;
+    sqe->fd = r->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(slot->buf + slot->filled);
+    sqe->len = (unsigned)(slot->len - slot->filled);
+    sqe->off = (uint64_t)(slot->off + (off_t)slot->filled);
+    sqe->user_data = (uint64_t)s;
+    r->sq_array[idx] = idx;
+    atomic_store_explicit(r->sq_tail, tail + 1, memory_order_release);
+
+    if (sys_io_uring_enter(r->ring_fd, 1, 0, 0) != 1)
+    {
+        // the SQE stays in the ring and would be submitted by the next enter
+        r->broken = true;
+        return -1;
+    }
+    slot->inflight = true;
+    r->inflight++;
+    return 0;
+}
+
+// Start reading the next chunk of the file into slot s (no-op past end of file)
+static int start_chunk(UringReader *r, int s)
+{
+    UrSlot *slot = &r->slots[s];
+    slot->off = r->next_off;
+    slot->len = 0;
+    slot->filled = 0;
+    slot->err = 0;
+    if (r->next_off >= r->size)
+        return 0;
+    off_t left = r->size - r->next_off;
+    slot->len = left < UR_CHUNK ? (size_t)left : UR_CHUNK;
+    r->next_off += (off_t)slot->len;
+    return submit_slot(r, s);
+}
+
+// Block for at least one completion and account for every completion available
+static int reap(UringReader *r)
+{
+    unsigned head = atomic_load_explicit(r->cq_head, memory_order_relaxed);
+    while (head == atomic_load_explicit(r->cq_tail, memory_order_acquire))
+    {
+        if (sys_io_uring_enter(r->ring_fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+            return -1;
+    }
+
+    for (; head != atomic_load_explicit(r->cq_tail, memory_order_acquire); ++head)
+    {
+        struct io_uring_cqe *cqe = &r->cqes[head & *r->cq_mask];
+        UrSlot *slot = &r->slots[cqe->user_data];
+        slot->inflight = false;
+        r->inflight--;
+        if (cqe->res < 0)
+            slot->err = -cqe->res;
+        else if (cqe->res == 0)
+            slot->err = EIO; // file shrank under us
+        else
+            slot->filled += (size_t)cqe->res;
+    }
+    atomic_store_explicit(r->cq_head, head, memory_order_release);
+    return 0;
+}
+
+// Tear down the ring and its buffers (no reads may be in flight)
+static void destroy_reader(UringReader *r)
+{
+    if (r->sqes && r->sqes != MAP_FAILED)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_map_len && r->cq_ptr && r->cq_ptr != MAP_FAILED)
+        munmap(r->cq_ptr, r->cq_map_len);
+    if (r->sq_ptr && r->sq_ptr != MAP_FAILED)
+        munmap(r->sq_ptr, r->sq_map_len);
+    if (r->ring_fd >= 0)
+        close(r->ring_fd);
+    for (int s = 0; s < UR_DEPTH; ++s)
+    {
+        if (r->slots[s].buf)
+            stats_mem_add(MEM_STAGING, -UR_CHUNK);
+        free(r->slots[s].buf);
+    }
+    free(r);
+}
+
+// Set up a ring and its chunk buffers, not yet attached to a file
+static UringReader *create_reader(void)
+{
+    UringReader *r = calloc(1, sizeof(UringReader));
+    if (!r)
+        return NULL;
+    r->fd = -1;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    r->ring_fd = sys_io_uring_setup(UR_DEPTH, &p);
+    if (r->ring_fd < 0 || map_rings(r, &p) != 0)
+        goto fail;
+
+    for (int s = 0; s < UR_DEPTH; ++s)
+    {
+        r->slots[s].buf = malloc(UR_CHUNK);
+        if (!r->slots[s].buf)
+            goto fail;
+        stats_mem_add(MEM_STAGING, UR_CHUNK);
+    }
+    return r;
+
+fail:
+    destroy_reader(r);
+    return NULL;
+}
+
+UringReader *uring_reader_open(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return NULL;
+    }
+
+    UringReader *r = NULL;
+    pthread_mutex_lock(&pool_lock);
+    if (pool_len > 0)
+        r = pool[--pool_len];
+    pthread_mutex_unlock(&pool_lock);
+    if (!r && !(r = create_reader()))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    r->fd = fd;
+    r->size = st.st_size;
+    r->next_off = 0;
+    r->cur = 0;
+    r->pos = 0;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    for (int s = 0; s < UR_DEPTH; ++s)
+    {
+        if (start_chunk(r, s) != 0)
+        {
+            uring_reader_close(r);
+            return NULL;
+        }
+    }
+    return r;
+}
+
+ssize_t uring_reader_read(UringReader *r, void *dst, size_t len)
+{
+    uint8_t *out = dst;
+    size_t done = 0;
+
+    while (done < len)
+    {
+        UrSlot *slot = &r->slots[r->cur];
+        if (slot->len == 0)
+            break; // end of file
+
+        // wait until the current chunk is complete (short reads are continued)
+        while (slot->filled < slot->len)
+        {
+            if (slot->err)
+                return -1;
+            if (!slot->inflight && submit_slot(r, r->cur) != 0)
+                return -1;
+            if (reap(r) != 0)
+                return -1;
+        }
+
+        size_t n = slot->len - r->pos;
+        if (n > len - done)
+            n = len - done;
+        memcpy(out + done, slot->buf + r->pos, n);
+        done += n;
+        r->pos += n;
+
+        if (r->pos == slot->len)
+        {
+            // chunk consumed: reuse its buffer for the chunk UR_DEPTH ahead
+            if (start_chunk(r, r->cur) != 0)
+                return -1;
+            r->cur = (r->cur + 1) % UR_DEPTH;
+            r->pos = 0;
+        }
+    }
+    return (ssize_t)done;
+}
+
+void uring_reader_close(UringReader *r)
+{
+    if (!r)
+        return;
+    // the kernel may still write into the buffers: wait for every read in flight
+    bool healthy = true;
+    while (r->inflight > 0 && healthy)
+        healthy = reap(r) == 0;
+    if (r->fd >= 0)
+        close(r->fd);
+    r->fd = -1;
+
+    // keep the ring and its buffers for the next file unless the pool is full or the ring failed
+    pthread_mutex_lock(&pool_lock);
+    if (healthy && !r->broken && pool_len < UR_POOL)
+    {
+        pool[pool_len++] = r;
+        r = NULL;
+    }
+    pthread_mutex_unlock(&pool_lock);
+    if (r)
+        destroy_reader(r);
+}
@@ -0,0 +1,20 @@
+#ifndef URING_READER_H
+#define URING_READER_H
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Sequential file reader backed by io_uring (raw syscalls, no liburing): keeps several large
+   reads in flight ahead of the consumer, so a slow SD card or fuse-zip mount is read while
+   libpng decodes the chunks already delivered. */
+typedef struct UringReader UringReader;
+
+// Open path for reading. Returns NULL if the file can't be opened or io_uring is unavailable.
+UringReader *uring_reader_open(const char *path);
+
+// Copy the next len bytes (fewer only at end of file) into dst. Returns bytes copied or -1.
+ssize_t uring_reader_read(UringReader *r, void *dst, size_t len);
+
+// Waits for reads still in flight and closes the file; the ring and its buffers are kept for reuse
+void uring_reader_close(UringReader *r);
+
+#endif